@@ -1,114 +1,1367 @@
 #include <iostream>
 #include <libusb.h>
 #include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <random>
+#include <cerrno>
+#include <unistd.h>
 
 using namespace std;
 
-const char* getDeviceClass(uint8_t class_code) {
-    switch(class_code) {
-        case 0x00: return "Device";
-        case 0x01: return "Audio";
-        case 0x02: return "Communications";
-        case 0x03: return "HID (Human Interface Device)";
-        case 0x05: return "Physical";
-        case 0x06: return "Image";
-        case 0x07: return "Printer";
-        case 0x08: return "Mass Storage";
-        case 0x09: return "Hub";
-        case 0x0A: return "CDC-Data";
-        case 0x0B: return "Smart Card";
-        case 0x0D: return "Content Security";
-        case 0x0E: return "Video";
-        case 0x0F: return "Personal Healthcare";
-        case 0x10: return "Audio/Video";
-        case 0xEF: return "Miscellaneous";
-        case 0xFE: return "Application Specific";
-        case 0xFF: return "Vendor Specific";
-        default: return "Unknown";
+// Названия классов по коду: таблица на все 256 значений собирается при
+// компиляции, поиск — одно обращение по индексу
+struct DeviceClassTable {
+    const char *names[256];
+};
+
+constexpr DeviceClassTable makeDeviceClassTable() {
+    DeviceClassTable t{};
+    for (int i = 0; i < 256; i++) {
+        t.names[i] = "Unknown";
     }
+    t.names[0x00] = "Device";
+    t.names[0x01] = "Audio";
+    t.names[0x02] = "Communications";
+    t.names[0x03] = "HID (Human Interface Device)";
+    t.names[0x05] = "Physical";
+    t.names[0x06] = "Image";
+    t.names[0x07] = "Printer";
+    t.names[0x08] = "Mass Storage";
+    t.names[0x09] = "Hub";
+    t.names[0x0A] = "CDC-Data";
+    t.names[0x0B] = "Smart Card";
+    t.names[0x0D] = "Content Security";
+    t.names[0x0E] = "Video";
+    t.names[0x0F] = "Personal Healthcare";
+    t.names[0x10] = "Audio/Video";
+    t.names[0xEF] = "Miscellaneous";
+    t.names[0xFE] = "Application Specific";
+    t.names[0xFF] = "Vendor Specific";
+    return t;
 }
 
-string getSerialNumber(libusb_device_handle *dev, uint8_t serial_index) {
-    if (serial_index == 0) {
-        return "N/A";
+constexpr DeviceClassTable kDeviceClasses = makeDeviceClassTable();
+
+inline const char* getDeviceClass(uint8_t class_code) {
+    return kDeviceClasses.names[class_code];
+}
+
+// Буфер вывода: всё форматирование идёт в заранее выделенную память без
+// iostream, в fd уходит одним write() на пачку (или при заполнении буфера)
+class OutBuffer {
+public:
+    OutBuffer(int fd, size_t capacity) : fd_(fd), buf_(new char[capacity]), cap_(capacity) {}
+    ~OutBuffer() {
+        flush();
+        delete[] buf_;
+    }
+
+    void put(char c) {
+        if (len_ == cap_) flush();
+        buf_[len_++] = c;
     }
+    void put(const char *s, size_t n);
+    void put(const char *s) { put(s, strlen(s)); }
+    void put(const string &s) { put(s.data(), s.size()); }
+
+    void dec(unsigned long v);
+    void hex(unsigned v, int digits);       // строчные, с ведущими нулями
+    void jsonString(const string &s);
+
+    // little-endian, для двоичного формата
+    void u8(uint8_t v) { put((char)v); }
+    void u16(uint16_t v) { put((char)(v & 0xFF)); put((char)(v >> 8)); }
+    void u32(uint32_t v) { u16((uint16_t)(v & 0xFFFF)); u16((uint16_t)(v >> 16)); }
+    void shortString(const string &s);      // длина u8 + байты, не длиннее 255
 
-    unsigned char serial_number[256];
-    int ret = libusb_get_string_descriptor_ascii(dev, serial_index, serial_number, sizeof(serial_number));
+    void flush();
 
-    if (ret < 0) {
-        return "Error reading serial";
+private:
+    int fd_;
+    char *buf_;
+    size_t cap_;
+    size_t len_ = 0;
+};
+
+void OutBuffer::put(const char *s, size_t n) {
+    while (n > 0) {
+        if (len_ == cap_) flush();
+        size_t chunk = min(n, cap_ - len_);
+        memcpy(buf_ + len_, s, chunk);
+        len_ += chunk;
+        s += chunk;
+        n -= chunk;
     }
+}
 
-    return string(reinterpret_cast<char*>(serial_number));
+void OutBuffer::dec(unsigned long v) {
+    char tmp[20];
+    int n = 0;
+    do {
+        tmp[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    while (n > 0) put(tmp[--n]);
 }
 
-int main() {
+void OutBuffer::hex(unsigned v, int digits) {
+    static const char digits_lc[] = "0123456789abcdef";
+    for (int shift = (digits - 1) * 4; shift >= 0; shift -= 4) {
+        put(digits_lc[(v >> shift) & 0xF]);
+    }
+}
+
+void OutBuffer::jsonString(const string &s) {
+    put('"');
+    for (size_t i = 0; i < s.size(); i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') {
+            put('\\');
+            put((char)c);
+        } else if (c < 0x20) {
+            put("\\u00");
+            hex(c, 2);
+        } else {
+            put((char)c);
+        }
+    }
+    put('"');
+}
+
+void OutBuffer::shortString(const string &s) {
+    size_t n = min(s.size(), (size_t)255);
+    u8((uint8_t)n);
+    put(s.data(), n);
+}
+
+void OutBuffer::flush() {
+    size_t off = 0;
+    while (off < len_) {
+        ssize_t w = write(fd_, buf_ + off, len_ - off);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            break;  // stdout закрыт — вывод теряется, как у cout
+        }
+        off += (size_t)w;
+    }
+    len_ = 0;
+}
+
+// Доступ к устройствам. Реестр и чтение дескрипторов работают только через
+// этот интерфейс, поэтому вместо libusb можно подставить симулированное
+// дерево устройств (--sim, --bench) и гонять перечисление без железа.
+typedef void *UsbDevice;    // непрозрачные указатели конкретного бэкенда
+typedef void *UsbHandle;
+
+// завершение асинхронного GET_DESCRIPTOR, вызывается из handleEvents
+typedef void (*DescriptorCallback)(void *user, libusb_transfer_status status,
+                                   const unsigned char *data, int length);
+typedef void (*HotplugCallback)(void *user, UsbDevice dev, bool arrived);
+
+class UsbBackend {
+public:
+    virtual ~UsbBackend() {}
+
+    // подключённые устройства, каждое со ссылкой (отпускать через unref)
+    virtual int listDevices(vector<UsbDevice> &out) = 0;
+    virtual UsbDevice ref(UsbDevice dev) = 0;
+    virtual void unref(UsbDevice dev) = 0;
+
+    virtual string portPath(UsbDevice dev) = 0;
+    virtual uint8_t busNumber(UsbDevice dev) = 0;
+    virtual uint8_t address(UsbDevice dev) = 0;
+    // без обращения к шине: дескриптор устройства уже в памяти
+    virtual int deviceDescriptor(UsbDevice dev, libusb_device_descriptor &out) = 0;
+
+    // ошибки — коды libusb_error
+    virtual int open(UsbDevice dev, UsbHandle &out) = 0;
+    virtual void close(UsbHandle handle) = 0;
+    virtual int submitGetDescriptor(UsbHandle handle, uint8_t type, uint8_t index, uint16_t langid,
+                                    uint16_t length, unsigned timeout_ms,
+                                    DescriptorCallback cb, void *user) = 0;
+    // обработать завершённые передачи, ждать не дольше timeout_ms
+    virtual void handleEvents(unsigned timeout_ms) = 0;
+
+    // false — hotplug не поддерживается; иначе колбэк сразу вызывается
+    // и для уже подключённых устройств
+    virtual bool registerHotplug(HotplugCallback cb, void *user) = 0;
+    virtual void deregisterHotplug() = 0;
+};
+
+class LibusbBackend : public UsbBackend {
+public:
+    explicit LibusbBackend(libusb_context *ctx) : ctx_(ctx) {}
+
+    int listDevices(vector<UsbDevice> &out);
+    UsbDevice ref(UsbDevice dev) { return libusb_ref_device((libusb_device*)dev); }
+    void unref(UsbDevice dev) { libusb_unref_device((libusb_device*)dev); }
+
+    string portPath(UsbDevice dev);
+    uint8_t busNumber(UsbDevice dev) { return libusb_get_bus_number((libusb_device*)dev); }
+    uint8_t address(UsbDevice dev) { return libusb_get_device_address((libusb_device*)dev); }
+    int deviceDescriptor(UsbDevice dev, libusb_device_descriptor &out) {
+        return libusb_get_device_descriptor((libusb_device*)dev, &out);
+    }
+
+    int open(UsbDevice dev, UsbHandle &out);
+    void close(UsbHandle handle) { libusb_close((libusb_device_handle*)handle); }
+    int submitGetDescriptor(UsbHandle handle, uint8_t type, uint8_t index, uint16_t langid,
+                            uint16_t length, unsigned timeout_ms, DescriptorCallback cb, void *user);
+    void handleEvents(unsigned timeout_ms);
+
+    bool registerHotplug(HotplugCallback cb, void *user);
+    void deregisterHotplug();
+
+private:
+    struct Pending {
+        DescriptorCallback cb;
+        void *user;
+    };
+
+    static void LIBUSB_CALL onTransfer(libusb_transfer *transfer);
+    static int LIBUSB_CALL onHotplug(libusb_context *ctx, libusb_device *dev,
+                                     libusb_hotplug_event event, void *user_data);
+
+    libusb_context *ctx_;
+    libusb_hotplug_callback_handle hotplug_{};
+    bool hotplug_registered_ = false;
+    HotplugCallback hotplug_cb_ = NULL;
+    void *hotplug_user_ = NULL;
+};
+
+int LibusbBackend::listDevices(vector<UsbDevice> &out) {
     libusb_device **devs = NULL;
-    libusb_context *ctx = NULL;
-    int r = libusb_init(&ctx);
+    ssize_t cnt = libusb_get_device_list(ctx_, &devs);
+    if (cnt < 0) {
+        return (int)cnt;
+    }
+    for (ssize_t i = 0; i < cnt; i++) {
+        out.push_back(libusb_ref_device(devs[i]));
+    }
+    libusb_free_device_list(devs, 1);
+    return 0;
+}
+
+// Путь устройства в дереве: шина и порты до него, как в sysfs ("1-2.3").
+// В отличие от адреса, не меняется при переподключении в тот же порт.
+string LibusbBackend::portPath(UsbDevice dev) {
+    libusb_device *d = (libusb_device*)dev;
+    uint8_t ports[8];
+    int n = libusb_get_port_numbers(d, ports, sizeof(ports));
+    string path = to_string(libusb_get_bus_number(d)) + "-";
+    if (n <= 0) {
+        return path + "0"; // корневой хаб
+    }
+    for (int i = 0; i < n; i++) {
+        if (i) path += '.';
+        path += to_string(ports[i]);
+    }
+    return path;
+}
+
+int LibusbBackend::open(UsbDevice dev, UsbHandle &out) {
+    libusb_device_handle *handle = NULL;
+    int r = libusb_open((libusb_device*)dev, &handle);
+    if (r == 0 && handle == NULL) {
+        r = LIBUSB_ERROR_OTHER;
+    }
+    out = handle;
+    return r;
+}
 
+int LibusbBackend::submitGetDescriptor(UsbHandle handle, uint8_t type, uint8_t index, uint16_t langid,
+                                       uint16_t length, unsigned timeout_ms,
+                                       DescriptorCallback cb, void *user) {
+    libusb_transfer *t = libusb_alloc_transfer(0);
+    unsigned char *buf = (unsigned char*)malloc(LIBUSB_CONTROL_SETUP_SIZE + length);
+    if (!t || !buf) {
+        if (t) libusb_free_transfer(t);
+        free(buf);
+        return LIBUSB_ERROR_NO_MEM;
+    }
+
+    libusb_fill_control_setup(buf, LIBUSB_ENDPOINT_IN, LIBUSB_REQUEST_GET_DESCRIPTOR,
+                              (uint16_t)((type << 8) | index), langid, length);
+    libusb_fill_control_transfer(t, (libusb_device_handle*)handle, buf, onTransfer,
+                                 new Pending{cb, user}, timeout_ms);
+    t->flags = LIBUSB_TRANSFER_FREE_BUFFER | LIBUSB_TRANSFER_FREE_TRANSFER;
+
+    int r = libusb_submit_transfer(t);
     if (r < 0) {
-        cerr << "Error initializing libusb: " << libusb_error_name(r) << endl;
-        return -1;
+        delete (Pending*)t->user_data;
+        libusb_free_transfer(t);
     }
+    return r;
+}
 
-    // Логирование
-    libusb_set_option(ctx, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_WARNING);
+void LIBUSB_CALL LibusbBackend::onTransfer(libusb_transfer *transfer) {
+    Pending *p = (Pending*)transfer->user_data;
+    p->cb(p->user, transfer->status, libusb_control_transfer_get_data(transfer), transfer->actual_length);
+    delete p;
+}
 
-    // Список всех USB-устройств
-    ssize_t cnt = libusb_get_device_list(ctx, &devs);
+void LibusbBackend::handleEvents(unsigned timeout_ms) {
+    timeval tv = {(time_t)(timeout_ms / 1000), (suseconds_t)(timeout_ms % 1000 * 1000)};
+    libusb_handle_events_timeout_completed(ctx_, &tv, NULL);
+}
 
-    if (cnt < 0) {
-        cerr << "Error getting device list: " << libusb_error_name(cnt) << endl;
-        libusb_exit(ctx);
-        return -1;
+int LIBUSB_CALL LibusbBackend::onHotplug(libusb_context *, libusb_device *dev,
+                                         libusb_hotplug_event event, void *user_data) {
+    LibusbBackend *self = static_cast<LibusbBackend*>(user_data);
+    self->hotplug_cb_(self->hotplug_user_, dev, event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED);
+    return 0; // не снимать колбэк
+}
+
+bool LibusbBackend::registerHotplug(HotplugCallback cb, void *user) {
+    if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+        return false;
     }
+    hotplug_cb_ = cb;
+    hotplug_user_ = user;
 
-    cout << "Found " << cnt << " USB device(s)" << endl;
-    cout << "========================================" << endl;
-    cout << endl;
+    // ENUMERATE: колбэк сразу вызывается для уже подключённых устройств
+    int r = libusb_hotplug_register_callback(
+            ctx_,
+            LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+            LIBUSB_HOTPLUG_ENUMERATE,
+            LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+            onHotplug, this, &hotplug_);
+    if (r != LIBUSB_SUCCESS) {
+        cerr << "Error registering hotplug callback: " << libusb_error_name(r) << endl;
+        return false;
+    }
+    hotplug_registered_ = true;
+    return true;
+}
 
-    for (ssize_t i = 0; i < cnt; i++) {
-        libusb_device *dev = devs[i];
-        libusb_device_descriptor desc{};
+void LibusbBackend::deregisterHotplug() {
+    if (hotplug_registered_) {
+        libusb_hotplug_deregister_callback(ctx_, hotplug_);
+        hotplug_registered_ = false;
+    }
+}
+
+// Параметры симулированного дерева
+struct SimConfig {
+    int devices = 100;          // всего устройств, включая корневые хабы
+    int buses = 1;
+    int ports = 4;              // портов на хабе
+    unsigned latency_us = 1000; // задержка одной передачи
+    double jitter = 0.5;        // разброс задержки, доля от latency_us
+    double open_fail = 0.0;     // доля устройств, которые не открываются
+    double xfer_fail = 0.0;     // доля передач, завершающихся STALL
+    unsigned seed = 1;
+};
+
+// Симулированная шина. Дерево строится как куча: у узла k (k > 0) на своей
+// шине родитель (k - 1) / ports, узлы с детьми становятся хабами. Передачи
+// завершаются в handleEvents по истечении задержки, как настоящие async-передачи.
+class SimBackend : public UsbBackend {
+public:
+    explicit SimBackend(const SimConfig &cfg);
 
-        // Дескриптор
-        r = libusb_get_device_descriptor(dev, &desc);
+    // сколько устройств помещается на одну шину: не глубже 7 портов
+    // и не больше 127 адресов, включая корневой хаб
+    static long capacity(int ports);
+
+    int listDevices(vector<UsbDevice> &out);
+    UsbDevice ref(UsbDevice dev) { return dev; }
+    void unref(UsbDevice) {}
+
+    string portPath(UsbDevice dev) { return ((Device*)dev)->path; }
+    uint8_t busNumber(UsbDevice dev) { return ((Device*)dev)->bus; }
+    uint8_t address(UsbDevice dev) { return ((Device*)dev)->address; }
+    int deviceDescriptor(UsbDevice dev, libusb_device_descriptor &out) {
+        out = ((Device*)dev)->desc;
+        return 0;
+    }
+
+    int open(UsbDevice dev, UsbHandle &out);
+    void close(UsbHandle) {}
+    int submitGetDescriptor(UsbHandle handle, uint8_t type, uint8_t index, uint16_t langid,
+                            uint16_t length, unsigned timeout_ms, DescriptorCallback cb, void *user);
+    void handleEvents(unsigned timeout_ms);
+
+    bool registerHotplug(HotplugCallback, void *) { return false; }
+    void deregisterHotplug() {}
+
+    uint64_t transfers() const { return transfers_; }
+
+private:
+    struct Device {
+        string path;
+        uint8_t bus;
+        uint8_t address;
+        libusb_device_descriptor desc;
+        bool open_fails;
+        uint8_t num_interfaces;
+        string strings[4];      // по индексу строкового дескриптора, 0 не используется
+    };
+
+    struct Transfer {
+        libusb_transfer_status status;
+        vector<unsigned char> data;
+        DescriptorCallback cb;
+        void *user;
+    };
+
+    SimConfig cfg_;
+    vector<Device> devices_;    // не меняется после конструктора
+
+    mutex m_;
+    condition_variable cv_;
+    multimap<chrono::steady_clock::time_point, Transfer> pending_;
+    mt19937 rng_;
+    atomic<uint64_t> transfers_{0};
+};
+
+long SimBackend::capacity(int ports) {
+    long total = 1, level = 1;
+    for (int depth = 1; depth <= 7; depth++) {
+        level *= ports;
+        total += level;
+        if (total >= 127) break;
+    }
+    return min(total, 127L);
+}
+
+SimBackend::SimBackend(const SimConfig &cfg) : cfg_(cfg), rng_(cfg.seed) {
+    static const uint8_t leaf_classes[] = {0x03, 0x08, 0x01, 0x0E, 0x02, 0xFF};
+    uniform_real_distribution<double> u(0.0, 1.0);
+
+    devices_.resize(cfg.devices);
+    for (int j = 0; j < cfg.devices; j++) {
+        Device &d = devices_[j];
+        int bus = j % cfg.buses + 1;
+        long k = j / cfg.buses;             // номер узла на своей шине
+        long on_bus = (cfg.devices - bus) / cfg.buses + 1;
+
+        d.bus = (uint8_t)bus;
+        d.address = (uint8_t)(k + 1);
+
+        vector<int> ports;
+        for (long n = k; n > 0; n = (n - 1) / cfg.ports) {
+            ports.push_back((int)((n - 1) % cfg.ports + 1));
+        }
+        d.path = to_string(bus) + "-";
+        if (ports.empty()) {
+            d.path += "0";
+        }
+        for (size_t i = ports.size(); i-- > 0;) {
+            d.path += to_string(ports[i]);
+            if (i) d.path += '.';
+        }
+
+        bool hub = k == 0 || k * cfg.ports + 1 < on_bus;
+        memset(&d.desc, 0, sizeof(d.desc));
+        d.desc.bLength = LIBUSB_DT_DEVICE_SIZE;
+        d.desc.bDescriptorType = LIBUSB_DT_DEVICE;
+        d.desc.bcdUSB = 0x0200;
+        d.desc.bDeviceClass = hub ? 0x09 : leaf_classes[j % 6];
+        d.desc.idVendor = (uint16_t)(k == 0 ? 0x1d6b : 0x1000 + j % 64);
+        d.desc.idProduct = (uint16_t)(k == 0 ? 0x0002 : j);
+        d.desc.iManufacturer = 1;
+        d.desc.iProduct = 2;
+        d.desc.iSerialNumber = 3;
+        d.desc.bNumConfigurations = 1;
+
+        d.open_fails = k != 0 && u(rng_) < cfg.open_fail;
+        d.num_interfaces = hub ? 1 : (uint8_t)(1 + j % 3);
+        d.strings[1] = k == 0 ? "Linux Foundation" : "Sim Vendor " + to_string(j % 64);
+        d.strings[2] = hub ? "Sim Hub" : "Sim Device";
+        d.strings[3] = "SIM" + to_string(100000 + j);
+    }
+}
+
+int SimBackend::listDevices(vector<UsbDevice> &out) {
+    for (size_t i = 0; i < devices_.size(); i++) {
+        out.push_back(&devices_[i]);
+    }
+    return 0;
+}
+
+int SimBackend::open(UsbDevice dev, UsbHandle &out) {
+    Device *d = (Device*)dev;
+    if (d->open_fails) {
+        return LIBUSB_ERROR_ACCESS;
+    }
+    out = d;
+    return 0;
+}
+
+int SimBackend::submitGetDescriptor(UsbHandle handle, uint8_t type, uint8_t index, uint16_t,
+                                    uint16_t length, unsigned timeout_ms,
+                                    DescriptorCallback cb, void *user) {
+    const Device *d = (const Device*)handle;
+    Transfer t;
+    t.status = LIBUSB_TRANSFER_COMPLETED;
+    t.cb = cb;
+    t.user = user;
+
+    if (type == LIBUSB_DT_STRING && index == 0) {
+        const unsigned char langids[] = {4, LIBUSB_DT_STRING, 0x09, 0x04};  // en-US
+        t.data.assign(langids, langids + sizeof(langids));
+    } else if (type == LIBUSB_DT_STRING && index < 4) {
+        const string &s = d->strings[index];
+        t.data.push_back((unsigned char)(2 + 2 * s.size()));
+        t.data.push_back(LIBUSB_DT_STRING);
+        for (size_t i = 0; i < s.size(); i++) {
+            t.data.push_back((unsigned char)s[i]);
+            t.data.push_back(0);
+        }
+    } else if (type == LIBUSB_DT_CONFIG && index == 0) {
+        uint16_t total = (uint16_t)(9 + 9 * d->num_interfaces);
+        const unsigned char config[] = {9, LIBUSB_DT_CONFIG, (unsigned char)(total & 0xFF), (unsigned char)(total >> 8),
+                                        d->num_interfaces, 1, 0, 0x80, 50};
+        t.data.assign(config, config + sizeof(config));
+    } else {
+        t.status = LIBUSB_TRANSFER_STALL;
+    }
+    if (t.data.size() > length) {
+        t.data.resize(length);
+    }
+
+    lock_guard<mutex> lock(m_);
+    uniform_real_distribution<double> u(0.0, 1.0);
+    if (u(rng_) < cfg_.xfer_fail) {
+        t.status = LIBUSB_TRANSFER_STALL;
+        t.data.clear();
+    }
+    double delay_us = cfg_.latency_us * (1.0 + cfg_.jitter * (2.0 * u(rng_) - 1.0));
+    if (timeout_ms && delay_us > timeout_ms * 1000.0) {
+        delay_us = timeout_ms * 1000.0;
+        t.status = LIBUSB_TRANSFER_TIMED_OUT;
+        t.data.clear();
+    }
+
+    chrono::steady_clock::time_point due =
+            chrono::steady_clock::now() + chrono::microseconds((long long)delay_us);
+    bool first = pending_.empty() || due < pending_.begin()->first;
+    pending_.insert(make_pair(due, t));
+    transfers_++;
+    if (first) {
+        cv_.notify_all();
+    }
+    return 0;
+}
+
+void SimBackend::handleEvents(unsigned timeout_ms) {
+    chrono::steady_clock::time_point deadline =
+            chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+
+    unique_lock<mutex> lock(m_);
+    while (true) {
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        if (!pending_.empty() && pending_.begin()->first <= now) {
+            break;
+        }
+        if (now >= deadline) {
+            return;
+        }
+        chrono::steady_clock::time_point wake = deadline;
+        if (!pending_.empty() && pending_.begin()->first < wake) {
+            wake = pending_.begin()->first;
+        }
+        cv_.wait_until(lock, wake);
+    }
+
+    // колбэки вызываются без блокировки: они могут отправлять новые передачи
+    vector<Transfer> done;
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    while (!pending_.empty() && pending_.begin()->first <= now) {
+        done.push_back(pending_.begin()->second);
+        pending_.erase(pending_.begin());
+    }
+    lock.unlock();
+
+    for (size_t i = 0; i < done.size(); i++) {
+        Transfer &t = done[i];
+        t.cb(t.user, t.status, t.data.empty() ? NULL : &t.data[0], (int)t.data.size());
+    }
+}
+
+struct UsbDeviceInfo {
+    string path;
+    uint8_t bus = 0;
+    uint8_t address = 0;
+    libusb_device_descriptor desc{};
+    bool valid = false;     // дескриптор устройства прочитан
+    bool opened = false;    // удалось ли открыть устройство
+    string serial;
+    string manufacturer;
+    string product;
+
+    // заголовок дескриптора конфигурации 0
+    bool has_config = false;
+    uint8_t num_interfaces = 0;
+    uint8_t config_value = 0;
+    uint16_t max_power_ma = 0;
+};
+
+// Асинхронное чтение строковых дескрипторов и дескриптора конфигурации.
+// Запросы ко всем устройствам отправляются сразу, завершения обрабатывает
+// поток событий, так что время опроса определяется самым медленным
+// устройством, а не суммой по всем.
+class DescriptorFetcher {
+public:
+    DescriptorFetcher(UsbBackend &backend, unsigned timeout_ms)
+            : backend_(backend), timeout_ms_(timeout_ms) {}
+
+    // блокирует до завершения (или таймаута) всех запросов;
+    // требует, чтобы события бэкенда обрабатывались в другом потоке
+    void fetch(const vector<UsbDevice> &devs, const vector<UsbDeviceInfo*> &out);
+
+private:
+    enum Kind { LANGIDS, SERIAL, MANUFACTURER, PRODUCT, CONFIG };
+
+    struct DeviceState {
+        DescriptorFetcher *owner;
+        UsbDeviceInfo *info;
+        UsbHandle handle;
+        chrono::steady_clock::time_point deadline;
+    };
+
+    struct Request {
+        DeviceState *dev;
+        Kind kind;
+    };
+
+    static void onDescriptor(void *user, libusb_transfer_status status, const unsigned char *data, int len);
+    void submit(DeviceState *dev, Kind kind, uint8_t desc_type, uint8_t index, uint16_t langid);
+    void complete(DeviceState *dev, Kind kind, libusb_transfer_status status, const unsigned char *data, int len);
+    static string *target(DeviceState *dev, Kind kind);
+
+    UsbBackend &backend_;
+    unsigned timeout_ms_;
+    mutex m_;
+    condition_variable done_cv_;
+    int pending_ = 0;
+};
+
+string *DescriptorFetcher::target(DeviceState *dev, Kind kind) {
+    switch (kind) {
+        case SERIAL: return &dev->info->serial;
+        case MANUFACTURER: return &dev->info->manufacturer;
+        case PRODUCT: return &dev->info->product;
+        default: return NULL;
+    }
+}
+
+// вызывается под m_
+void DescriptorFetcher::submit(DeviceState *dev, Kind kind, uint8_t desc_type, uint8_t index, uint16_t langid) {
+    long left = chrono::duration_cast<chrono::milliseconds>(dev->deadline - chrono::steady_clock::now()).count();
+    if (left <= 0) {
+        string *s = target(dev, kind);
+        if (s) *s = "Timeout";
+        return;
+    }
+
+    Request *req = new Request{dev, kind};
+    int r = backend_.submitGetDescriptor(dev->handle, desc_type, index, langid, 255, (unsigned)left,
+                                         onDescriptor, req);
+    if (r < 0) {
+        delete req;
+        string *s = target(dev, kind);
+        if (s) *s = string("Error: ") + libusb_error_name(r);
+        return;
+    }
+    pending_++;
+}
+
+void DescriptorFetcher::onDescriptor(void *user, libusb_transfer_status status, const unsigned char *data, int len) {
+    Request *req = (Request*)user;
+    DescriptorFetcher *self = req->dev->owner;
+
+    lock_guard<mutex> lock(self->m_);
+    self->complete(req->dev, req->kind, status, data, len);
+    delete req;
+    if (--self->pending_ == 0) {
+        self->done_cv_.notify_all();
+    }
+}
+
+// вызывается под m_ из потока событий
+void DescriptorFetcher::complete(DeviceState *dev, Kind kind, libusb_transfer_status status,
+                                 const unsigned char *data, int len) {
+    bool ok = status == LIBUSB_TRANSFER_COMPLETED;
+    UsbDeviceInfo *info = dev->info;
+
+    if (kind == LANGIDS) {
+        // строки запрашиваем на первом языке из списка, как libusb_get_string_descriptor_ascii
+        const uint8_t idx[] = {info->desc.iSerialNumber, info->desc.iManufacturer, info->desc.iProduct};
+        const Kind kinds[] = {SERIAL, MANUFACTURER, PRODUCT};
+        for (int i = 0; i < 3; i++) {
+            if (idx[i] == 0) continue;
+            if (ok && len >= 4) {
+                submit(dev, kinds[i], LIBUSB_DT_STRING, idx[i], (uint16_t)(data[2] | (data[3] << 8)));
+            } else {
+                *target(dev, kinds[i]) = status == LIBUSB_TRANSFER_TIMED_OUT
+                                         ? "Timeout" : "Error reading descriptor";
+            }
+        }
+        return;
+    }
+
+    if (kind == CONFIG) {
+        if (ok && len >= 9 && data[1] == LIBUSB_DT_CONFIG) {
+            info->has_config = true;
+            info->num_interfaces = data[4];
+            info->config_value = data[5];
+            // bMaxPower: единицы 2 мА, у SuperSpeed (USB 3.x) — 8 мА
+            info->max_power_ma = (uint16_t)(data[8] * (info->desc.bcdUSB >= 0x0300 ? 8 : 2));
+        }
+        return;
+    }
+
+    string *s = target(dev, kind);
+    if (!ok || len < 2 || data[1] != LIBUSB_DT_STRING) {
+        *s = status == LIBUSB_TRANSFER_TIMED_OUT ? "Timeout" : "Error reading descriptor";
+        return;
+    }
+    // UTF-16LE -> ASCII, прочие символы заменяются на '?'
+    s->clear();
+    int n = min(len, (int)data[0]);
+    for (int i = 2; i + 1 < n; i += 2) {
+        *s += (data[i + 1] || (data[i] & 0x80)) ? '?' : (char)data[i];
+    }
+}
+
+void DescriptorFetcher::fetch(const vector<UsbDevice> &devs, const vector<UsbDeviceInfo*> &out) {
+    vector<DeviceState> states(devs.size());
+    chrono::steady_clock::time_point deadline =
+            chrono::steady_clock::now() + chrono::milliseconds(timeout_ms_);
+
+    unique_lock<mutex> lock(m_);
+    for (size_t i = 0; i < devs.size(); i++) {
+        UsbDeviceInfo *info = out[i];
+        info->bus = backend_.busNumber(devs[i]);
+        info->address = backend_.address(devs[i]);
+
+        int r = backend_.deviceDescriptor(devs[i], info->desc);
         if (r < 0) {
             cerr << "Error getting device descriptor: " << libusb_error_name(r) << endl;
             continue;
         }
+        info->valid = true;
+
+        DeviceState &st = states[i];
+        st.owner = this;
+        st.info = info;
+        st.handle = NULL;
+        st.deadline = deadline;
+        if (backend_.open(devs[i], st.handle) != 0) {
+            st.handle = NULL;
+            continue;
+        }
+        info->opened = true;
+        info->serial = info->desc.iSerialNumber ? "" : "N/A";
+
+        if (info->desc.iSerialNumber || info->desc.iManufacturer || info->desc.iProduct) {
+            submit(&st, LANGIDS, LIBUSB_DT_STRING, 0, 0);
+        }
+        submit(&st, CONFIG, LIBUSB_DT_CONFIG, 0, 0);
+    }
+
+    done_cv_.wait(lock, [this] { return pending_ == 0; });
+    lock.unlock();
+
+    // закрываем здесь, а не в колбэке: колбэк выполняется внутри обработки событий
+    for (size_t i = 0; i < states.size(); i++) {
+        if (states[i].handle) backend_.close(states[i].handle);
+    }
+}
+
+// Порядок путей как в дереве: по шине, затем по номерам портов как числам
+// ("1-2" раньше "1-10", хаб раньше своих устройств)
+struct PortPathLess {
+    bool operator()(const string &a, const string &b) const {
+        size_t i = 0, j = 0;
+        while (i < a.size() && j < b.size()) {
+            unsigned long x = strtoul(a.c_str() + i, NULL, 10);
+            unsigned long y = strtoul(b.c_str() + j, NULL, 10);
+            if (x != y) return x < y;
+            i = a.find_first_of("-.", i);
+            j = b.find_first_of("-.", j);
+            if (i == string::npos || j == string::npos) break;
+            i++;
+            j++;
+        }
+        return i == string::npos && j != string::npos;
+    }
+};
+
+// Реестр устройств: один раз перечисляет шину, дальше обновляется по
+// hotplug-событиям. Дескрипторы и серийные номера кэшируются по пути
+// устройства, так что запросы обслуживаются из памяти без обращений к шине.
+class UsbRegistry {
+public:
+    UsbRegistry(UsbBackend &backend, unsigned timeout_ms) : backend_(backend), fetcher_(backend, timeout_ms) {}
+    ~UsbRegistry() { stop(); }
+
+    bool start();
+    void stop();
+
+    // дождаться, пока все поступившие события будут обработаны
+    void waitIdle();
+
+    vector<UsbDeviceInfo> snapshot() const;
+    bool find(const string &path, UsbDeviceInfo &out) const;
+
+    // растёт при каждом изменении списка
+    uint64_t version() const;
+
+private:
+    struct Event {
+        bool arrived;
+        string path;
+        UsbDevice dev;          // со ссылкой, только для arrived
+    };
 
-        cout << "Device " << (int)i + 1 << ":" << endl;
+    static void hotplugCallback(void *user, UsbDevice dev, bool arrived);
+    void enqueue(UsbDevice dev, bool arrived);
+    void finishEnumeration();
+    void eventLoop();
+    void worker();
+
+    UsbBackend &backend_;
+    DescriptorFetcher fetcher_;
+    bool hotplug_registered_ = false;
+    atomic<bool> running_{false};
+    atomic<bool> events_running_{false};   // поток событий нужен, пока жив worker
+    thread events_;
+    thread worker_;
+
+    mutable mutex m_;
+    condition_variable queue_cv_;
+    condition_variable idle_cv_;
+    deque<Event> queue_;
+    bool enumerating_ = false;  // идёт первое перечисление: worker ждёт всю пачку
+    bool busy_ = false;
+    map<string, UsbDeviceInfo, PortPathLess> devices_;
+    uint64_t version_ = 0;
+};
+
+void UsbRegistry::hotplugCallback(void *user, UsbDevice dev, bool arrived) {
+    static_cast<UsbRegistry*>(user)->enqueue(dev, arrived);
+}
+
+void UsbRegistry::enqueue(UsbDevice dev, bool arrived) {
+    Event e;
+    e.arrived = arrived;
+    e.path = backend_.portPath(dev);
+    e.dev = arrived ? backend_.ref(dev) : NULL;
+
+    lock_guard<mutex> lock(m_);
+    queue_.push_back(e);
+    if (!enumerating_) {
+        queue_cv_.notify_one();
+    }
+}
+
+bool UsbRegistry::start() {
+    running_ = true;
+    events_running_ = true;
+    {
+        // уже подключённые устройства опрашиваются одной пачкой, иначе worker
+        // может забрать первое устройство и ждать его до прихода остальных
+        lock_guard<mutex> lock(m_);
+        enumerating_ = true;
+    }
+    events_ = thread(&UsbRegistry::eventLoop, this);
+    worker_ = thread(&UsbRegistry::worker, this);
+
+    if (backend_.registerHotplug(hotplugCallback, this)) {
+        hotplug_registered_ = true;
+        finishEnumeration();
+        return true;
+    }
+
+    // Без hotplug (например, Windows) — одно перечисление при старте
+    vector<UsbDevice> devs;
+    int r = backend_.listDevices(devs);
+    if (r < 0) {
+        cerr << "Error getting device list: " << libusb_error_name(r) << endl;
+        stop();
+        return false;
+    }
+    for (size_t i = 0; i < devs.size(); i++) {
+        enqueue(devs[i], true);
+        backend_.unref(devs[i]);
+    }
+    finishEnumeration();
+    return true;
+}
+
+void UsbRegistry::finishEnumeration() {
+    lock_guard<mutex> lock(m_);
+    enumerating_ = false;
+    queue_cv_.notify_one();
+    idle_cv_.notify_all();
+}
+
+void UsbRegistry::stop() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+    if (hotplug_registered_) {
+        backend_.deregisterHotplug();
+        hotplug_registered_ = false;
+    }
+    {
+        lock_guard<mutex> lock(m_);
+        queue_cv_.notify_all();
+        idle_cv_.notify_all();
+    }
+    // worker может ждать завершения передач, поэтому поток событий — после него
+    if (worker_.joinable()) worker_.join();
+    events_running_ = false;
+    if (events_.joinable()) events_.join();
+
+    for (size_t i = 0; i < queue_.size(); i++) {
+        if (queue_[i].dev) backend_.unref(queue_[i].dev);
+    }
+    queue_.clear();
+}
+
+void UsbRegistry::eventLoop() {
+    while (events_running_) {
+        backend_.handleEvents(100);
+    }
+}
+
+void UsbRegistry::worker() {
+    unique_lock<mutex> lock(m_);
+    while (true) {
+        queue_cv_.wait(lock, [this] { return (!queue_.empty() && !enumerating_) || !running_; });
+        if (!running_) {
+            break;
+        }
+
+        // забираем всё, что накопилось: новые устройства пачки опрашиваются параллельно
+        deque<Event> batch;
+        batch.swap(queue_);
+        busy_ = true;
+        lock.unlock();
+
+        vector<UsbDeviceInfo> infos(batch.size());
+        vector<UsbDevice> devs;
+        vector<UsbDeviceInfo*> targets;
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (!batch[i].arrived) continue;
+            infos[i].path = batch[i].path;
+            devs.push_back(batch[i].dev);
+            targets.push_back(&infos[i]);
+        }
+        fetcher_.fetch(devs, targets);
+        for (size_t i = 0; i < devs.size(); i++) {
+            backend_.unref(devs[i]);
+        }
+
+        // события применяются строго по порядку, поэтому «ушло» после
+        // «пришло» для того же порта не потеряется
+        lock.lock();
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (batch[i].arrived && infos[i].valid) {
+                devices_[batch[i].path] = infos[i];
+            } else {
+                devices_.erase(batch[i].path);
+            }
+        }
+        version_++;
+        busy_ = false;
+        if (queue_.empty()) {
+            idle_cv_.notify_all();
+        }
+    }
+}
+
+void UsbRegistry::waitIdle() {
+    unique_lock<mutex> lock(m_);
+    idle_cv_.wait(lock, [this] { return (queue_.empty() && !busy_ && !enumerating_) || !running_; });
+}
+
+vector<UsbDeviceInfo> UsbRegistry::snapshot() const {
+    lock_guard<mutex> lock(m_);
+    vector<UsbDeviceInfo> out;
+    out.reserve(devices_.size());
+    for (map<string, UsbDeviceInfo, PortPathLess>::const_iterator it = devices_.begin(); it != devices_.end(); ++it) {
+        out.push_back(it->second);
+    }
+    return out;
+}
+
+bool UsbRegistry::find(const string &path, UsbDeviceInfo &out) const {
+    lock_guard<mutex> lock(m_);
+    map<string, UsbDeviceInfo, PortPathLess>::const_iterator it = devices_.find(path);
+    if (it == devices_.end()) {
+        return false;
+    }
+    out = it->second;
+    return true;
+}
+
+uint64_t UsbRegistry::version() const {
+    lock_guard<mutex> lock(m_);
+    return version_;
+}
+
+enum OutputFormat { FORMAT_TEXT, FORMAT_JSONL, FORMAT_BINARY };
+
+void writeText(OutBuffer &out, const vector<UsbDeviceInfo> &devices) {
+    out.put("Found ");
+    out.dec(devices.size());
+    out.put(" USB device(s)\n========================================\n\n");
+
+    for (size_t i = 0; i < devices.size(); i++) {
+        const UsbDeviceInfo &d = devices[i];
+
+        out.put("Device ");
+        out.dec(i + 1);
+        out.put(" (");
+        out.put(d.path);
+        out.put("):\n");
 
         // Вывод класса
-        cout << " -- Class: " << getDeviceClass(desc.bDeviceClass)
-             << " (0x" << hex << setfill('0') << setw(2) << (int)desc.bDeviceClass << ")" << dec << endl;
+        out.put(" -- Class: ");
+        out.put(getDeviceClass(d.desc.bDeviceClass));
+        out.put(" (0x");
+        out.hex(d.desc.bDeviceClass, 2);
+        out.put(")\n");
 
         // Вывод VID и PID
-        cout << " ---- Vendor ID: 0x" << hex << setfill('0') << setw(4) << desc.idVendor << dec << endl;
-        cout << " ------ Product ID: 0x" << hex << setfill('0') << setw(4) << desc.idProduct << dec << endl;
+        out.put(" ---- Vendor ID: 0x");
+        out.hex(d.desc.idVendor, 4);
+        out.put("\n ------ Product ID: 0x");
+        out.hex(d.desc.idProduct, 4);
+        out.put('\n');
+
+        if (d.opened) {
+            out.put(" -------- Serial Number: ");
+            out.put(d.serial);
+            out.put('\n');
+            if (d.desc.iManufacturer) {
+                out.put(" -------- Manufacturer: ");
+                out.put(d.manufacturer);
+                out.put('\n');
+            }
+            if (d.desc.iProduct) {
+                out.put(" -------- Product: ");
+                out.put(d.product);
+                out.put('\n');
+            }
+            if (d.has_config) {
+                out.put(" -------- Configuration ");
+                out.dec(d.config_value);
+                out.put(": ");
+                out.dec(d.num_interfaces);
+                out.put(" interface(s), ");
+                out.dec(d.max_power_ma);
+                out.put(" mA\n");
+            }
+        } else {
+            out.put("  Serial Number: Could not open device (may require root/sudo)\n");
+        }
+
+        out.put('\n');
+    }
+}
+
+// Одна строка JSON на устройство. Строковые поля есть только у открытых
+// устройств, config — только если дескриптор конфигурации прочитан.
+void writeJsonLines(OutBuffer &out, const vector<UsbDeviceInfo> &devices) {
+    for (size_t i = 0; i < devices.size(); i++) {
+        const UsbDeviceInfo &d = devices[i];
+
+        out.put("{\"path\":");
+        out.jsonString(d.path);
+        out.put(",\"bus\":");
+        out.dec(d.bus);
+        out.put(",\"address\":");
+        out.dec(d.address);
+        out.put(",\"class\":\"");
+        out.hex(d.desc.bDeviceClass, 2);
+        out.put("\",\"class_name\":\"");
+        out.put(getDeviceClass(d.desc.bDeviceClass));   // имена из таблицы экранировать не нужно
+        out.put("\",\"vid\":\"");
+        out.hex(d.desc.idVendor, 4);
+        out.put("\",\"pid\":\"");
+        out.hex(d.desc.idProduct, 4);
+        out.put(d.opened ? "\",\"opened\":true" : "\",\"opened\":false");
+
+        if (d.opened) {
+            out.put(",\"serial\":");
+            out.jsonString(d.serial);
+            if (d.desc.iManufacturer) {
+                out.put(",\"manufacturer\":");
+                out.jsonString(d.manufacturer);
+            }
+            if (d.desc.iProduct) {
+                out.put(",\"product\":");
+                out.jsonString(d.product);
+            }
+            if (d.has_config) {
+                out.put(",\"config\":{\"value\":");
+                out.dec(d.config_value);
+                out.put(",\"interfaces\":");
+                out.dec(d.num_interfaces);
+                out.put(",\"max_power_ma\":");
+                out.dec(d.max_power_ma);
+                out.put('}');
+            }
+        }
+        out.put("}\n");
+    }
+}
+
+// Двоичный формат, все числа little-endian:
+//   пачка:  "USB1", u32 число записей, записи
+//   запись: u8 bus, u8 address, u8 class, u8 flags (1 — открыто, 2 — есть config),
+//           u16 vid, u16 pid, u8 interfaces, u8 config value, u16 max power mA,
+//           строки path, serial, manufacturer, product (u8 длина + байты)
+void writeBinary(OutBuffer &out, const vector<UsbDeviceInfo> &devices) {
+    out.put("USB1", 4);
+    out.u32((uint32_t)devices.size());
+
+    for (size_t i = 0; i < devices.size(); i++) {
+        const UsbDeviceInfo &d = devices[i];
+
+        out.u8(d.bus);
+        out.u8(d.address);
+        out.u8(d.desc.bDeviceClass);
+        out.u8((uint8_t)((d.opened ? 1 : 0) | (d.has_config ? 2 : 0)));
+        out.u16(d.desc.idVendor);
+        out.u16(d.desc.idProduct);
+        out.u8(d.num_interfaces);
+        out.u8(d.config_value);
+        out.u16(d.max_power_ma);
+        out.shortString(d.path);
+        out.shortString(d.serial);
+        out.shortString(d.manufacturer);
+        out.shortString(d.product);
+    }
+}
+
+// Вывод одной пачки (снимка реестра)
+void printDevices(OutBuffer &out, const vector<UsbDeviceInfo> &devices, OutputFormat format) {
+    switch (format) {
+        case FORMAT_TEXT: writeText(out, devices); break;
+        case FORMAT_JSONL: writeJsonLines(out, devices); break;
+        case FORMAT_BINARY: writeBinary(out, devices); break;
+    }
+    out.flush();
+}
+
+// Время полного перечисления симулированного дерева в зависимости от числа
+// устройств. «sequential» — оценка для последовательного опроса: сумма
+// задержек всех передач.
+void runBench(const SimConfig &base, unsigned timeout_ms, int repeats) {
+    static const int counts[] = {1, 10, 25, 50, 100, 250, 500, 1000, 2000, 5000};
+    vector<int> sizes;
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]) && counts[i] < base.devices; i++) {
+        sizes.push_back(counts[i]);
+    }
+    sizes.push_back(base.devices);
+
+    cout << "Simulated scan: " << base.buses << " bus(es), " << base.ports << " ports/hub, latency "
+         << base.latency_us << " us +-" << (int)(base.jitter * 100) << "%, open fail "
+         << base.open_fail * 100 << "%, transfer fail " << base.xfer_fail * 100 << "%, "
+         << repeats << " repeats" << endl;
+    cout << setw(8) << "devices" << setw(12) << "scan ms" << setw(12) << "min ms"
+         << setw(12) << "dev/s" << setw(14) << "transfers/s" << setw(10) << "opened"
+         << setw(16) << "sequential ms" << endl;
+
+    for (size_t s = 0; s < sizes.size(); s++) {
+        SimConfig cfg = base;
+        cfg.devices = sizes[s];
+
+        vector<double> ms;
+        uint64_t transfers = 0;
+        size_t opened = 0;
+        for (int rep = 0; rep < repeats; rep++) {
+            SimBackend backend(cfg);
+            UsbRegistry registry(backend, timeout_ms);
+
+            chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+            if (!registry.start()) {
+                return;
+            }
+            registry.waitIdle();
+            chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+            registry.stop();
+
+            ms.push_back(chrono::duration<double, milli>(t1 - t0).count());
+            transfers = backend.transfers();
+            vector<UsbDeviceInfo> devices = registry.snapshot();
+            opened = 0;
+            for (size_t i = 0; i < devices.size(); i++) {
+                opened += devices[i].opened;
+            }
+        }
+        sort(ms.begin(), ms.end());
+        double med = ms[ms.size() / 2];
 
-        libusb_device_handle *handle = NULL;
-        r = libusb_open(dev, &handle);
+        cout << fixed << setprecision(2)
+             << setw(8) << cfg.devices << setw(12) << med << setw(12) << ms[0]
+             << setprecision(0)
+             << setw(12) << cfg.devices / (med / 1000.0) << setw(14) << transfers / (med / 1000.0)
+             << setw(10) << opened
+             << setprecision(2) << setw(16) << transfers * (cfg.latency_us / 1000.0) << endl;
+        cout.unsetf(ios::floatfield);
+    }
+}
 
-        if (r == 0 && handle != NULL) {
-            // Получение и вывод серийного номера
-            string serial = getSerialNumber(handle, desc.iSerialNumber);
-            cout << " -------- Serial Number: " << serial << endl;
+volatile sig_atomic_t stop_requested = 0;
+
+void onSignal(int) {
+    stop_requested = 1;
+}
 
-            libusb_close(handle);
+void usage(const char *prog) {
+    cerr << "usage: " << prog << " [--watch] [--timeout MS] [--format text|jsonl|binary]" << endl
+         << "       " << prog << " --sim|--bench [--devices N] [--buses N] [--ports N] [--latency US]" << endl
+         << "              [--jitter F] [--open-fail F] [--xfer-fail F] [--seed N] [--repeats N]" << endl;
+}
+
+int main(int argc, char **argv) {
+    // --watch: реестр живёт до Ctrl+C и печатает список при изменениях
+    // --timeout MS: сколько ждать ответа от одного устройства
+    // --sim: вместо libusb симулированное дерево; --bench: замер перечисления
+    // --format: text для человека, jsonl и binary для сборщиков
+    bool watch = false;
+    OutputFormat format = FORMAT_TEXT;
+    bool sim = false;
+    bool bench = false;
+    unsigned timeout_ms = 1000;
+    int repeats = 5;
+    SimConfig cfg;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--watch") == 0) {
+            watch = true;
+        } else if (strcmp(argv[i], "--sim") == 0) {
+            sim = true;
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            bench = true;
+        } else if (strcmp(argv[i], "--format") == 0 && has_value) {
+            const char *f = argv[++i];
+            if (strcmp(f, "text") == 0) {
+                format = FORMAT_TEXT;
+            } else if (strcmp(f, "jsonl") == 0) {
+                format = FORMAT_JSONL;
+            } else if (strcmp(f, "binary") == 0) {
+                format = FORMAT_BINARY;
+            } else {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--timeout") == 0 && has_value) {
+            timeout_ms = (unsigned)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--devices") == 0 && has_value) {
+            cfg.devices = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--buses") == 0 && has_value) {
+            cfg.buses = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--ports") == 0 && has_value) {
+            cfg.ports = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--latency") == 0 && has_value) {
+            cfg.latency_us = (unsigned)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--jitter") == 0 && has_value) {
+            cfg.jitter = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--open-fail") == 0 && has_value) {
+            cfg.open_fail = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--xfer-fail") == 0 && has_value) {
+            cfg.xfer_fail = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+            cfg.seed = (unsigned)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--repeats") == 0 && has_value) {
+            repeats = atoi(argv[++i]);
         } else {
-            cout << "  Serial Number: Could not open device (may require root/sudo)" << endl;
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (sim || bench) {
+        if (cfg.devices < 1 || cfg.buses < 1 || cfg.buses > 127 || cfg.ports < 1 || cfg.ports > 15
+            || repeats < 1 || cfg.jitter < 0 || cfg.jitter > 1) {
+            usage(argv[0]);
+            return -1;
+        }
+        if (cfg.devices > cfg.buses * SimBackend::capacity(cfg.ports)) {
+            cerr << "Too many devices for " << cfg.buses << " bus(es) with "
+                 << cfg.ports << " ports per hub (at most "
+                 << SimBackend::capacity(cfg.ports) << " per bus)" << endl;
+            return -1;
         }
+    }
 
-        cout << endl;
+    if (bench) {
+        runBench(cfg, timeout_ms, repeats);
+        return 0;
     }
 
-    libusb_free_device_list(devs, 1);
-    libusb_exit(ctx);
+    libusb_context *ctx = NULL;
+    UsbBackend *backend;
+    if (sim) {
+        backend = new SimBackend(cfg);
+    } else {
+        int r = libusb_init(&ctx);
+
+        if (r < 0) {
+            cerr << "Error initializing libusb: " << libusb_error_name(r) << endl;
+            return -1;
+        }
+
+        // Логирование
+        libusb_set_option(ctx, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_WARNING);
+        backend = new LibusbBackend(ctx);
+    }
 
-    cout << "Done!" << endl;
+    UsbRegistry *registry = new UsbRegistry(*backend, timeout_ms);
+    if (!registry->start()) {
+        delete registry;
+        delete backend;
+        if (ctx) libusb_exit(ctx);
+        return -1;
+    }
+    registry->waitIdle();
+
+    OutBuffer out(STDOUT_FILENO, 256 * 1024);
+    if (watch) {
+        signal(SIGINT, onSignal);
+        uint64_t shown = ~0ull;
+        while (!stop_requested) {
+            registry->waitIdle();
+            uint64_t v = registry->version();
+            if (v != shown) {
+                printDevices(out, registry->snapshot(), format);
+                shown = v;
+            }
+            this_thread::sleep_for(chrono::milliseconds(200));
+        }
+    } else {
+        printDevices(out, registry->snapshot(), format);
+    }
+
+    registry->stop();
+    delete registry;
+    delete backend;
+    if (ctx) libusb_exit(ctx);
+
+    if (format == FORMAT_TEXT) {
+        out.put("Done!\n");
+        out.flush();
+    }
     return 0;
 }
@@ -1,17 +1,75 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstdint>
+#include <cstring>
 #include <cmath>
 #include <ctime>
 #include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <array>
+#include <utility>
+#include <random>
 #include <algorithm>
+#include <cpuid.h>
+#include <immintrin.h>
 
 #ifdef _WIN32
+#define NOMINMAX    // иначе макросы min/max из windows.h ломают std::max({...})
 #include <windows.h>
+#else
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && !defined(MAP_HUGE_SHIFT)
+#define MAP_HUGE_SHIFT 26
 #endif
 
 using namespace std;
 
+struct Options {
+    int cpu = -1;       // ядро для привязки (-1: ядро 2, если оно есть)
+    bool fifo = false;  // SCHED_FIFO (Linux, нужен root или CAP_SYS_NICE)
+    const char *profile = nullptr;  // файл для профиля машины
+    string mode = "sweep";          // sweep | mlp | loaded | pages | c2c | write
+    string pages = "malloc";        // malloc | 4k | thp | 2m | 1g
+    int threads = -1;               // фоновые потоки для loaded (-1: все остальные ядра)
+    string traffic = "read";        // read | write | nt
+    string sync = "cas";            // c2c: cas | store
+    double tol = 2.0;               // допуск ДИ медианы, %
+    int max_repeats = 31;
+    const char *records = nullptr;  // CSV или JSON lines (*.json) по точкам свипа
+    uint64_t l2_raw = 0;            // raw-код события промахов L2 для perf
+};
+
+struct CpuInfo {
+    bool invariant_tsc = false;
+    double tsc_hz = 0;          // калибровка по steady_clock
+    double cpuid_tsc_hz = 0;    // CPUID 0x15, если заполнен
+    unsigned base_mhz = 0;      // CPUID 0x16
+    long cur_khz = -1;          // cpufreq
+    long max_khz = -1;
+};
+
+static CpuInfo g_cpu;
+
+// rand() на Windows даёт только 15 бит, для N до 64M этого мало
+static mt19937_64 g_rng;
+
+// шаги для разреженных обходов, в элементах int
+const int LINE_INTS = 64 / sizeof(int);
+const int PAGE_INTS = 4096 / sizeof(int);
+
 static uint64_t rdtsc_precise() {
     unsigned int lo, hi;
     unsigned aux;
@@ -24,6 +82,323 @@ static uint64_t rdtsc_precise() {
     return ((uint64_t)hi << 32) | lo;
 }
 
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--mode sweep|mlp|loaded|pages|c2c|write] [--cpu N] [--fifo] [--profile FILE]\n"
+                    "          [--pages malloc|4k|thp|2m|1g] [--threads N] [--traffic read|write|nt]\n"
+                    "          [--sync cas|store] [--tol PCT] [--max-repeats N]\n"
+                    "          [--records FILE.csv|FILE.json] [--l2-raw EVENT]\n", prog);
+}
+
+static Options parse_args(int argc, char **argv) {
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        if (a == "--cpu" && i + 1 < argc) {
+            opt.cpu = atoi(argv[++i]);
+        } else if (a == "--fifo") {
+            opt.fifo = true;
+        } else if (a == "--profile" && i + 1 < argc) {
+            opt.profile = argv[++i];
+        } else if (a == "--mode" && i + 1 < argc) {
+            opt.mode = argv[++i];
+        } else if (a == "--pages" && i + 1 < argc) {
+            opt.pages = argv[++i];
+        } else if (a == "--threads" && i + 1 < argc) {
+            opt.threads = atoi(argv[++i]);
+        } else if (a == "--traffic" && i + 1 < argc) {
+            opt.traffic = argv[++i];
+        } else if (a == "--sync" && i + 1 < argc) {
+            opt.sync = argv[++i];
+        } else if (a == "--tol" && i + 1 < argc) {
+            opt.tol = atof(argv[++i]);
+        } else if (a == "--max-repeats" && i + 1 < argc) {
+            opt.max_repeats = atoi(argv[++i]);
+        } else if (a == "--records" && i + 1 < argc) {
+            opt.records = argv[++i];
+        } else if (a == "--l2-raw" && i + 1 < argc) {
+            opt.l2_raw = strtoull(argv[++i], nullptr, 0);
+        } else {
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    const char *modes[] = {"sweep", "mlp", "loaded", "pages", "c2c", "write"};
+    if (find(begin(modes), end(modes), opt.mode) == end(modes)) {
+        fprintf(stderr, "unknown mode: %s\n", opt.mode.c_str());
+        usage(argv[0]);
+        exit(1);
+    }
+    if (opt.sync != "cas" && opt.sync != "store") {
+        fprintf(stderr, "unknown sync kind: %s\n", opt.sync.c_str());
+        usage(argv[0]);
+        exit(1);
+    }
+    return opt;
+}
+
+// привязка текущего потока к ядру
+static bool pin_to_cpu(int cpu) {
+#ifdef _WIN32
+    DWORD_PTR mask = 1ull << cpu;
+    return SetProcessAffinityMask(GetCurrentProcess(), mask)
+        && SetThreadAffinityMask(GetCurrentThread(), mask);
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+// привязка только текущего потока: на Windows pin_to_cpu меняет маску
+// всего процесса, а фоновые потоки не должны сдвигать измеряющий
+static bool pin_thread_to_cpu(int cpu) {
+#ifdef _WIN32
+    return SetThreadAffinityMask(GetCurrentThread(), 1ull << cpu) != 0;
+#else
+    return pin_to_cpu(cpu);
+#endif
+}
+
+// процессоры, на которых процессу разрешено работать (taskset, cpuset
+// cgroup, выключенные ядра). Читать до pin_to_cpu — потом маска из одного ядра.
+static vector<int> allowed_cpus() {
+    vector<int> cpus;
+#ifdef _WIN32
+    DWORD_PTR proc = 0, sys = 0;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &proc, &sys))
+        for (int c = 0; c < (int)sizeof(proc) * 8; ++c)
+            if (proc >> c & 1) cpus.push_back(c);
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        for (int c = 0; c < CPU_SETSIZE; ++c)
+            if (CPU_ISSET(c, &set)) cpus.push_back(c);
+#endif
+    if (cpus.empty())
+        for (int c = 0; c < (int)thread::hardware_concurrency(); ++c)
+            cpus.push_back(c);
+    return cpus;
+}
+
+static vector<int> g_allowed_cpus;
+
+static bool raise_priority(bool fifo) {
+#ifdef _WIN32
+    (void)fifo;
+    return SetPriorityClass(GetCurrentProcess(), REALTIME_PRIORITY_CLASS)
+        && SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+#elif defined(__linux__)
+    if (!fifo) return true;
+    // max - 1, чтобы не перебивать потоки ядра на максимальном приоритете
+    sched_param sp{};
+    sp.sched_priority = sched_get_priority_max(SCHED_FIFO) - 1;
+    return sched_setscheduler(0, SCHED_FIFO, &sp) == 0;
+#else
+    (void)fifo;
+    return false;
+#endif
+}
+
+static long read_sysfs_long(const string &path) {
+    FILE *f = fopen(path.c_str(), "r");
+    if (!f) return -1;
+    long v = -1;
+    if (fscanf(f, "%ld", &v) != 1) v = -1;
+    fclose(f);
+    return v;
+}
+
+// частота TSC относительно монотонных часов
+static double calibrate_tsc_hz() {
+    auto c0 = chrono::steady_clock::now();
+    uint64_t t0 = rdtsc_precise();
+    while (chrono::steady_clock::now() - c0 < chrono::milliseconds(200)) {}
+    auto c1 = chrono::steady_clock::now();
+    uint64_t t1 = rdtsc_precise();
+    return double(t1 - t0) / chrono::duration<double>(c1 - c0).count();
+}
+
+static void read_cpu_info(int cpu) {
+    unsigned eax, ebx, ecx, edx;
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+        g_cpu.invariant_tsc = (edx >> 8) & 1;
+    if (__get_cpuid_count(0x15, 0, &eax, &ebx, &ecx, &edx) && eax && ebx && ecx)
+        g_cpu.cpuid_tsc_hz = double(ecx) * ebx / eax;
+    if (__get_cpuid_count(0x16, 0, &eax, &ebx, &ecx, &edx))
+        g_cpu.base_mhz = eax & 0xFFFF;
+
+    string dir = "/sys/devices/system/cpu/cpu" + to_string(cpu) + "/cpufreq/";
+    g_cpu.cur_khz = read_sysfs_long(dir + "scaling_cur_freq");
+    g_cpu.max_khz = read_sysfs_long(dir + "cpuinfo_max_freq");
+
+    g_cpu.tsc_hz = calibrate_tsc_hz();
+}
+
+static void print_cpu_info(int cpu) {
+    printf("# cpu %d: invariant TSC %s, TSC %.1f MHz (calibrated)",
+           cpu, g_cpu.invariant_tsc ? "yes" : "no", g_cpu.tsc_hz / 1e6);
+    if (g_cpu.cpuid_tsc_hz > 0) printf(", %.1f MHz (cpuid 0x15)", g_cpu.cpuid_tsc_hz / 1e6);
+    printf("\n");
+    if (g_cpu.base_mhz) printf("# base %u MHz (cpuid 0x16)\n", g_cpu.base_mhz);
+    if (g_cpu.cur_khz > 0)
+        printf("# cpufreq: cur %.1f MHz, max %.1f MHz\n", g_cpu.cur_khz / 1e3, g_cpu.max_khz / 1e3);
+    else
+        printf("# cpufreq: unavailable\n");
+}
+
+static uint64_t median_of(vector<uint64_t> v) {
+    nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+    return v[v.size() / 2];
+}
+
+// прогрев: крутим фиксированную нагрузку, пока время итерации по rdtscp
+// не перестанет меняться. TSC идёт с постоянной частотой, поэтому стабильное
+// число тиков на итерацию означает, что частота ядра установилась.
+// Сравниваем медианы двух соседних окон, чтобы единичные прерывания не мешали.
+static void warmup_until_stable(double tolerance = 0.01, int window = 16, double max_seconds = 10.0) {
+    const int M = 1 << 20;
+    vector<uint64_t> hist;
+    volatile double sink = 0;
+    bool stable = false;
+    uint64_t med = 0;
+    auto start = chrono::steady_clock::now();
+
+    while (true) {
+        uint64_t t1 = rdtsc_precise();
+        double s = 1.0;
+        for (int i = 0; i < M; ++i)
+            s = s * 1.0000001 + 1e-9; // зависимая цепочка, не векторизуется
+        sink = s;
+        uint64_t t2 = rdtsc_precise();
+        hist.push_back(t2 - t1);
+
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if ((int)hist.size() >= 2 * window && elapsed >= 0.1) {
+            uint64_t prev = median_of(vector<uint64_t>(hist.end() - 2 * window, hist.end() - window));
+            med = median_of(vector<uint64_t>(hist.end() - window, hist.end()));
+            if (fabs(double(med) - double(prev)) <= tolerance * double(prev)) {
+                stable = true;
+                break;
+            }
+        }
+        if (elapsed >= max_seconds) break;
+    }
+    (void)sink;
+
+    printf("# warmup: %zu iterations, %llu ticks/iteration%s\n", hist.size(),
+           (unsigned long long)med, stable ? "" : " (not stable, timeout)");
+}
+
+// ---------- выделение памяти с разными страницами ----------
+
+enum class PagePolicy { Malloc, Small, THP, Huge2M, Huge1G };
+
+static const char *page_policy_name(PagePolicy p) {
+    switch (p) {
+        case PagePolicy::Malloc: return "malloc";
+        case PagePolicy::Small: return "4k";
+        case PagePolicy::THP: return "thp";
+        case PagePolicy::Huge2M: return "2m";
+        case PagePolicy::Huge1G: return "1g";
+    }
+    return "?";
+}
+
+static bool parse_page_policy(const string &s, PagePolicy &p) {
+    for (PagePolicy q : {PagePolicy::Malloc, PagePolicy::Small, PagePolicy::THP,
+                         PagePolicy::Huge2M, PagePolicy::Huge1G}) {
+        if (s == page_policy_name(q)) {
+            p = q;
+            return true;
+        }
+    }
+    return false;
+}
+
+static size_t page_policy_size(PagePolicy p) {
+    switch (p) {
+        case PagePolicy::THP:
+        case PagePolicy::Huge2M: return 2u << 20;
+        case PagePolicy::Huge1G: return 1u << 30;
+        default: return 4096;
+    }
+}
+
+struct Buffer {
+    void *p = nullptr;
+    void *base = nullptr;   // начало отображения (для THP p выровнен внутри него)
+    size_t mapped = 0;      // 0 — выделено через malloc
+};
+
+// буфер под выбранную политику страниц. Память сразу отображается,
+// чтобы обход не ловил page fault'ы вместо промахов TLB.
+static Buffer alloc_buffer(size_t bytes, PagePolicy policy) {
+    Buffer b;
+    if (policy == PagePolicy::Malloc) {
+        b.p = malloc(bytes);
+        return b;
+    }
+#ifdef __linux__
+    size_t page = page_policy_size(policy);
+    size_t len = (bytes + page - 1) / page * page;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if (policy == PagePolicy::Huge2M) flags |= MAP_HUGETLB | (21 << MAP_HUGE_SHIFT);
+    if (policy == PagePolicy::Huge1G) flags |= MAP_HUGETLB | (30 << MAP_HUGE_SHIFT);
+    // для THP берём запас, чтобы выровнять начало на 2 МБ
+    size_t map_len = policy == PagePolicy::THP ? len + page : len;
+
+    char *m = (char*)mmap(nullptr, map_len, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (m == MAP_FAILED) return b;
+
+    char *p = m;
+    if (policy == PagePolicy::THP) {
+        p = (char*)(((uintptr_t)m + page - 1) & ~(uintptr_t)(page - 1));
+        madvise(p, len, MADV_HUGEPAGE);
+    } else if (policy == PagePolicy::Small) {
+        // иначе при transparent_hugepage=always ядро может подставить большие страницы
+        madvise(p, len, MADV_NOHUGEPAGE);
+    }
+
+    for (size_t off = 0; off < len; off += 4096)
+        p[off] = 0;
+
+    b.p = p;
+    b.base = m;
+    b.mapped = map_len;
+#endif
+    return b;
+}
+
+static void free_buffer(Buffer &b) {
+#ifdef __linux__
+    if (b.mapped) {
+        munmap(b.base, b.mapped);
+        b = Buffer();
+        return;
+    }
+#endif
+    free(b.p);
+    b = Buffer();
+}
+
+// сколько анонимной памяти процесса сейчас покрыто THP
+static long anon_huge_kb() {
+    FILE *f = fopen("/proc/self/smaps_rollup", "r");
+    if (!f) return -1;
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1) break;
+    fclose(f);
+    return kb;
+}
+
 void make_forward(int *a, int N) {
     for (int i = 0; i < N - 1; ++i)
         a[i] = i + 1;
@@ -36,129 +411,1303 @@ void make_backward(int *a, int N) {
         a[i] = i - 1;
 }
 
-// случайный цикл (Фишер–Йетс)
+// случайный цикл (Саттоло): в отличие от Фишера–Йетса даёт ровно один цикл
+// длины N, поэтому k = x[k] обходит весь массив, а не короткую петлю
 void make_random_cycle(int *a, int N) {
     for (int i = 0; i < N; ++i)
         a[i] = i;
 
     for (int i = N - 1; i > 0; --i) {
-        int j = rand() % (i + 1);
+        int j = int(g_rng() % i);
         swap(a[i], a[j]);
     }
 }
 
-double measure_ticks_per_access_once(int *x, int N, long long K) {
+// случайный цикл по одному элементу на блок из stride элементов:
+// LINE_INTS — по элементу на строку кэша, PAGE_INTS — по элементу на страницу.
+// Внутри страницы строка выбирается случайно, чтобы не бить в один набор кэша.
+// Возвращает длину цикла (0, если буфер пуст — тогда в a ничего не пишется).
+int make_random_strided_cycle(int *a, int N, int stride) {
+    if (N < 1)
+        return 0;
+    int M = max(N / stride, 1);
+    vector<int> node(M);
+    for (int i = 0; i < M; ++i) {
+        int off = 0;
+        // блок 0 начинается с нуля: обход стартует с k = 0
+        if (i > 0 && stride > LINE_INTS)
+            off = int(g_rng() % (stride / LINE_INTS)) * LINE_INTS;
+        node[i] = min(i * stride + off, N - 1);
+    }
+
+    vector<int> next(M);
+    make_random_cycle(next.data(), M);
+    for (int i = 0; i < M; ++i)
+        a[node[i]] = node[next[i]];
+    return M;
+}
+
+// ---------- аппаратные счётчики (perf_event_open) ----------
+
+enum PerfCounter { PC_CYCLES, PC_INSTRUCTIONS, PC_L1D_MISS, PC_L2_MISS, PC_LLC_MISS, PC_DTLB_MISS, PC_COUNT };
+
+static const char *PERF_NAMES[PC_COUNT] = {
+    "cycles", "instructions", "l1d_miss", "l2_miss", "llc_miss", "dtlb_miss"
+};
+
+struct PerfSample {
+    double v[PC_COUNT] = {};
+    bool has[PC_COUNT] = {};
+};
+
+// группа счётчиков с общим лидером (cycles): читаются атомарно одним read()
+struct PerfGroup {
+    int fd[PC_COUNT];
+    uint64_t id[PC_COUNT];
+    bool active = false;
+    PerfSample acc;             // сумма за текущую точку
+    long long accesses = 0;
+};
+
+static PerfGroup g_perf;
+
+#ifdef __linux__
+static int perf_open(uint32_t type, uint64_t config, int group_fd) {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group_fd < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID
+                     | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static uint64_t cache_event(uint64_t cache, uint64_t result) {
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+}
+#endif
+
+// открывает то, что доступно; в ВМ и при perf_event_paranoid > 2 счётчиков
+// может не быть вовсе, тогда замеры идут без них. У L2 нет общего события
+// perf, поэтому оно берётся только как raw-код (--l2-raw).
+static void perf_init(uint64_t l2_raw) {
+    for (int i = 0; i < PC_COUNT; ++i) g_perf.fd[i] = -1;
+#ifdef __linux__
+    int leader = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+    if (leader < 0) return;
+    g_perf.fd[PC_CYCLES] = leader;
+    g_perf.fd[PC_INSTRUCTIONS] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, leader);
+    g_perf.fd[PC_L1D_MISS] = perf_open(PERF_TYPE_HW_CACHE,
+                                       cache_event(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_MISS), leader);
+    if (l2_raw)
+        g_perf.fd[PC_L2_MISS] = perf_open(PERF_TYPE_RAW, l2_raw, leader);
+    g_perf.fd[PC_LLC_MISS] = perf_open(PERF_TYPE_HW_CACHE,
+                                       cache_event(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_RESULT_MISS), leader);
+    g_perf.fd[PC_DTLB_MISS] = perf_open(PERF_TYPE_HW_CACHE,
+                                        cache_event(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_RESULT_MISS), leader);
+
+    for (int i = 0; i < PC_COUNT; ++i)
+        if (g_perf.fd[i] >= 0 && ioctl(g_perf.fd[i], PERF_EVENT_IOC_ID, &g_perf.id[i]) < 0)
+            g_perf.fd[i] = -1;
+    g_perf.active = g_perf.fd[PC_CYCLES] >= 0;
+#else
+    (void)l2_raw;
+#endif
+}
+
+static void perf_print_status() {
+    if (!g_perf.active) {
+        printf("# perf counters: unavailable\n");
+        return;
+    }
+    printf("# perf counters:");
+    for (int i = 0; i < PC_COUNT; ++i)
+        printf(" %s%s", PERF_NAMES[i], g_perf.fd[i] >= 0 ? "" : "(n/a)");
+    printf("\n");
+}
+
+static void perf_reset_acc() {
+    g_perf.acc = PerfSample();
+    g_perf.accesses = 0;
+}
+
+static void perf_start() {
+#ifdef __linux__
+    if (!g_perf.active) return;
+    ioctl(g_perf.fd[PC_CYCLES], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(g_perf.fd[PC_CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+static void perf_stop(long long accesses) {
+#ifdef __linux__
+    if (!g_perf.active) return;
+    ioctl(g_perf.fd[PC_CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    // nr, time_enabled, time_running, затем пары {value, id}
+    uint64_t buf[3 + 2 * PC_COUNT];
+    if (read(g_perf.fd[PC_CYCLES], buf, sizeof(buf)) <= 0) return;
+    uint64_t nr = buf[0];
+    // группа ни разу не попала на PMU (занят watchdog'ом, урезанный PMU
+    // в виртуалке) — значений нет, а не нули
+    if (buf[2] == 0) return;
+    // при мультиплексировании счётчик работал не всё время — масштабируем
+    double scale = double(buf[1]) / double(buf[2]);
+    for (uint64_t k = 0; k < nr; ++k) {
+        for (int i = 0; i < PC_COUNT; ++i) {
+            if (g_perf.fd[i] >= 0 && g_perf.id[i] == buf[4 + 2 * k]) {
+                g_perf.acc.v[i] += double(buf[3 + 2 * k]) * scale;
+                g_perf.acc.has[i] = true;
+            }
+        }
+    }
+    g_perf.accesses += accesses;
+#else
+    (void)accesses;
+#endif
+}
+
+// накопленное за точку, в пересчёте на одно обращение
+static PerfSample perf_per_access() {
+    PerfSample s = g_perf.acc;
+    for (int i = 0; i < PC_COUNT; ++i)
+        if (s.has[i] && g_perf.accesses) s.v[i] /= double(g_perf.accesses);
+    return s;
+}
+
+double measure_ticks_per_access_once(int *x, long long accesses, long long warmup) {
     // прогрев
     volatile int k = 0;
-    for (long long i = 0; i < N * K; ++i)
+    for (long long i = 0; i < warmup; ++i)
         k = x[k];
     if (k == 12345) printf("warmup\n");
 
+    perf_start();
     uint64_t t1 = rdtsc_precise();
     k = 0;
-    for (long long i = 0; i < N * K; ++i)
+    for (long long i = 0; i < accesses; ++i)
         k = x[k];
     uint64_t t2 = rdtsc_precise();
+    perf_stop(accesses);
 
     if (k == 12345) printf("use\n");
 
-    return double(t2 - t1) / double(N * K);
+    return double(t2 - t1) / double(accesses);
 }
 
-// медиана
-double measure_ticks_per_access(int *x, int N, long long K, int repeats = 7) {
-    vector<double> vals;
-    vals.reserve(repeats);
-    for (int r = 0; r < repeats; ++r)
-        vals.push_back(measure_ticks_per_access_once(x, N, K));
+// параметры адаптивной выборки
+struct Sampling {
+    double tolerance = 0.02;    // допустимая полуширина 95% ДИ медианы, доля от медианы
+    int min_repeats = 6;        // при 6 замерах [min, max] накрывает медиану с вероятностью 97%
+    int max_repeats = 31;
+    long long warmup_bytes = 256LL << 20;  // больше последнего уровня кэша (×2) греть бесполезно
+};
+
+static Sampling g_sampling;
+
+struct Estimate {
+    double median = 0;
+    double ci = 0;      // относительная полуширина 95% ДИ медианы
+    int repeats = 0;
+};
+
+// P(Bin(n, 1/2) <= k)
+static double binom_half_cdf(int n, int k) {
+    double p = 0, c = 1;
+    for (int i = 0; i <= k; ++i) {
+        p += c;
+        c = c * (n - i) / (i + 1);
+    }
+    return p / pow(2.0, n);
+}
+
+// медиана и непараметрический ДИ по порядковым статистикам:
+// самый узкий интервал [x_(j), x_(n-1-j)] с покрытием не меньше 95%
+static Estimate median_ci(vector<double> v) {
+    sort(v.begin(), v.end());
+    int n = (int)v.size();
+    int j = 0;
+    while (j + 1 < n / 2 && 1.0 - 2.0 * binom_half_cdf(n, j + 1) >= 0.95)
+        ++j;
+    Estimate e;
+    e.median = v[n / 2];
+    e.ci = (v[n - 1 - j] - v[j]) / (2.0 * e.median);
+    e.repeats = n;
+    return e;
+}
+
+// добавляем замеры, пока ДИ медианы не уложится в допуск
+template <class F>
+static Estimate sample_until_stable(F measure) {
+    vector<double> v;
+    while (true) {
+        v.push_back(measure());
+        if ((int)v.size() < g_sampling.min_repeats) continue;
+        Estimate e = median_ci(v);
+        if (e.ci <= g_sampling.tolerance || (int)v.size() >= g_sampling.max_repeats)
+            return e;
+    }
+}
 
-    sort(vals.begin(), vals.end());
-    return vals[repeats / 2];
+// прогрев — один проход по циклу, но не больше, чем может уместиться в кэшах
+// прогрев в обращениях: сколько нужно, чтобы пройти warmup_bytes буфера.
+// bytes_per_access — сколько нового буфера покрывает одно обращение:
+// sizeof(int) для обходов по элементам, строка — для обходов по строкам и страницам.
+static long long warmup_for(long long cycle_len, long long bytes_per_access) {
+    return min(cycle_len, g_sampling.warmup_bytes / bytes_per_access);
 }
 
-double measure_random_ticks_per_access(int *buf, int N, long long K, int repeats = 7) {
-    vector<double> vals;
-    vals.reserve(repeats);
-    for (int r = 0; r < repeats; ++r) {
+// медиана
+Estimate measure_ticks_per_access(int *x, int N, long long K) {
+    return sample_until_stable([&] {
+        return measure_ticks_per_access_once(x, N * K, warmup_for(N, sizeof(int)));
+    });
+}
+
+// stride = 1 — полный случайный цикл, иначе см. make_random_strided_cycle.
+// Цикл строится один раз на все повторы: Саттоло последователен,
+// и на больших N его построение дороже самого замера.
+Estimate measure_random_ticks_per_access(int *buf, int N, int stride, long long K) {
+    int M = N;
+    if (stride == 1)
         make_random_cycle(buf, N);
-        vals.push_back(measure_ticks_per_access_once(buf, N, K));
+    else
+        M = make_random_strided_cycle(buf, N, stride);
+    return sample_until_stable([&] {
+        return measure_ticks_per_access_once(buf, N * K, warmup_for(M, stride == 1 ? sizeof(int) : 64));
+    });
+}
+
+// ---------- анализ кривой задержек ----------
+
+struct SweepPoint {
+    int N;
+    double fwd, bwd, rnd, line, page;
+};
+
+// уровень иерархии: плато на кривой задержки
+struct Level {
+    int first, last;   // индексы точек свипа
+    double ticks;      // медиана задержки на плато
+};
+
+struct SysCache {
+    int level;
+    string type;
+    long size_bytes;
+    long line_bytes;
+    long ways;
+};
+
+static double median_d(vector<double> v) {
+    sort(v.begin(), v.end());
+    return v[v.size() / 2];
+}
+
+static double ticks_to_ns(double ticks) {
+    return ticks / g_cpu.tsc_hz * 1e9;
+}
+
+// тики TSC в такты ядра; без cpufreq считаем, что ядро идёт с частотой TSC
+static double ticks_to_cycles(double ticks) {
+    if (g_cpu.cur_khz > 0) return ticks_to_ns(ticks) * g_cpu.cur_khz / 1e6;
+    return ticks;
+}
+
+static double segment_sse(const vector<double> &y, int l, int r) {
+    double m = 0;
+    for (int i = l; i < r; ++i) m += y[i];
+    m /= (r - l);
+    double s = 0;
+    for (int i = l; i < r; ++i) s += (y[i] - m) * (y[i] - m);
+    return s;
+}
+
+// бинарная сегментация: делим [l, r) в точке, минимизирующей сумму квадратов
+// отклонений, пока средние половин различаются больше чем в min_ratio раз
+static void split_segments(const vector<double> &y, int l, int r, double min_ratio, vector<int> &cuts) {
+    if (r - l < 4) return;
+    int best = -1;
+    double best_sse = segment_sse(y, l, r);
+    for (int k = l + 2; k <= r - 2; ++k) {
+        double s = segment_sse(y, l, k) + segment_sse(y, k, r);
+        if (s < best_sse) {
+            best_sse = s;
+            best = k;
+        }
     }
-    sort(vals.begin(), vals.end());
-    return vals[repeats / 2];
+    if (best < 0) return;
+
+    vector<double> left(y.begin() + l, y.begin() + best), right(y.begin() + best, y.begin() + r);
+    double a = median_d(left), b = median_d(right);
+    if (max(a, b) / min(a, b) < min_ratio) return;
+
+    cuts.push_back(best);
+    split_segments(y, l, best, min_ratio, cuts);
+    split_segments(y, best, r, min_ratio, cuts);
 }
 
-int main() {
-    srand((unsigned)time(nullptr));
+// поиск плато (уровней) на кривой задержки. Короткие сегменты на переходах
+// между уровнями отбрасываются, соседние плато с близкой задержкой сливаются.
+static vector<Level> find_levels(const vector<double> &ticks, double min_ratio = 1.2, int min_len = 3) {
+    vector<double> y(ticks.size());
+    for (size_t i = 0; i < ticks.size(); ++i) y[i] = log(ticks[i]);
 
-#ifdef _WIN32
-    // фиксируем процесс на одном ядре и поднимаем приоритет
-    HANDLE hProc = GetCurrentProcess();
-    HANDLE hThread = GetCurrentThread();
+    vector<int> cuts = {0, (int)y.size()};
+    split_segments(y, 0, (int)y.size(), min_ratio, cuts);
+    sort(cuts.begin(), cuts.end());
 
-    DWORD_PTR mask = 1ull << 2;
-    SetProcessAffinityMask(hProc, mask);
-    SetThreadAffinityMask(hProc, mask);
-    SetThreadAffinityMask(hThread, mask);
+    vector<Level> levels;
+    for (size_t i = 0; i + 1 < cuts.size(); ++i) {
+        int l = cuts[i], r = cuts[i + 1];
+        bool tail = r == (int)y.size();
+        if (r - l < min_len && !tail) continue;
+        double t = median_d(vector<double>(ticks.begin() + l, ticks.begin() + r));
+        if (!levels.empty() && t / levels.back().ticks < min_ratio) {
+            levels.back().last = r - 1;
+            continue;
+        }
+        levels.push_back({l, r - 1, t});
+    }
+    return levels;
+}
 
-    SetPriorityClass(hProc, REALTIME_PRIORITY_CLASS);
-    SetThreadPriority(hThread, THREAD_PRIORITY_TIME_CRITICAL);
-#endif
+static long parse_size(const string &s) {
+    long v = atol(s.c_str());
+    if (s.find('K') != string::npos) v *= 1024;
+    else if (s.find('M') != string::npos) v *= 1024 * 1024;
+    return v;
+}
 
-    // разгон CPU ~1 сек
-    {
-        const int M = 512;
-        double s = 0.0;
-        clock_t t0 = clock();
-        while (double(clock() - t0) / CLOCKS_PER_SEC < 1.0) {
-            for (int i = 0; i < M; ++i)
-                for (int j = 0; j < M; ++j)
-                    s += i * j;
+static string read_sysfs_string(const string &path) {
+    FILE *f = fopen(path.c_str(), "r");
+    if (!f) return "";
+    char buf[64] = {};
+    if (!fgets(buf, sizeof(buf), f)) buf[0] = 0;
+    fclose(f);
+    string s = buf;
+    while (!s.empty() && (s.back() == '\n' || s.back() == ' ')) s.pop_back();
+    return s;
+}
+
+// кэши данных ядра из /sys/devices/system/cpu/cpuN/cache
+static vector<SysCache> read_sys_caches(int cpu) {
+    vector<SysCache> caches;
+    for (int i = 0; ; ++i) {
+        string dir = "/sys/devices/system/cpu/cpu" + to_string(cpu) + "/cache/index" + to_string(i) + "/";
+        long level = read_sysfs_long(dir + "level");
+        if (level < 0) break;
+        string type = read_sysfs_string(dir + "type");
+        if (type == "Instruction") continue;
+        caches.push_back({(int)level, type, parse_size(read_sysfs_string(dir + "size")),
+                          read_sysfs_long(dir + "coherency_line_size"),
+                          read_sysfs_long(dir + "ways_of_associativity")});
+    }
+    sort(caches.begin(), caches.end(), [](const SysCache &a, const SysCache &b) { return a.level < b.level; });
+    return caches;
+}
+
+struct StridePoint {
+    int stride_bytes;
+    double seq_ticks;   // по порядку
+    double rnd_ticks;   // те же строки в случайном порядке
+};
+
+struct StrideProfile {
+    size_t buf_bytes = 0;
+    int line_bytes = 0;          // оценка размера строки
+    int prefetch_bytes = 0;      // максимальный шаг, на котором ещё помогает префетчер
+    vector<pair<int, double>> pair_ticks;    // смещение -> тики на пару обращений
+    vector<StridePoint> stride_ticks;
+};
+
+// пары обращений внутри случайно выбранных блоков по 1 КБ:
+// a[p] -> a[p + d] -> следующий блок. Пока d меньше строки, второе обращение
+// попадает в уже загруженную строку, начиная с d = строке — это новый промах.
+static double measure_pair_ticks(int *a, size_t n, int d_ints, long long accesses) {
+    const int BLOCK = 256;
+    int M = int(n / BLOCK);
+    vector<int> next(M);
+    make_random_cycle(next.data(), M);
+    for (int b = 0; b < M; ++b) {
+        a[b * BLOCK] = b * BLOCK + d_ints;
+        a[b * BLOCK + d_ints] = next[b] * BLOCK;
+    }
+    vector<double> v;
+    for (int r = 0; r < 3; ++r)
+        v.push_back(measure_ticks_per_access_once(a, accesses, warmup_for(2LL * M, 64)) * 2);
+    return median_d(v);
+}
+
+// обход узлов a[i*s] по порядку и в случайном порядке по тем же узлам:
+// при больших шагах узлов мало и они влезают в кэш, поэтому сравниваем
+// с тем же набором строк, а не с полным случайным обходом
+static pair<double, double> measure_stride_ticks(int *a, size_t n, int s_ints, long long accesses) {
+    int M = int(n / s_ints);
+    long long step_bytes = min<long long>((long long)s_ints * sizeof(int), 64);
+    vector<double> seq, rnd;
+    for (int i = 0; i < M; ++i)
+        a[(size_t)i * s_ints] = ((i + 1) % M) * s_ints;
+    for (int r = 0; r < 3; ++r)
+        seq.push_back(measure_ticks_per_access_once(a, accesses, warmup_for(M, step_bytes)));
+
+    vector<int> next(M);
+    make_random_cycle(next.data(), M);
+    for (int i = 0; i < M; ++i)
+        a[(size_t)i * s_ints] = next[i] * s_ints;
+    for (int r = 0; r < 3; ++r)
+        rnd.push_back(measure_ticks_per_access_once(a, accesses, warmup_for(M, step_bytes)));
+    return {median_d(seq), median_d(rnd)};
+}
+
+static StrideProfile stride_sweep(size_t buf_bytes) {
+    StrideProfile p;
+    p.buf_bytes = buf_bytes;
+    size_t n = buf_bytes / sizeof(int);
+    int *a = (int*)malloc(buf_bytes);
+    if (!a) return p;
+
+    const long long accesses = 4'000'000LL;
+
+    for (int d = 8; d <= 512; d *= 2)
+        p.pair_ticks.push_back({d, measure_pair_ticks(a, n, d / (int)sizeof(int), accesses)});
+    // первое смещение, на котором пара заметно подорожала
+    for (size_t i = 1; i < p.pair_ticks.size(); ++i) {
+        if (p.pair_ticks[i].second > 1.3 * p.pair_ticks[i - 1].second) {
+            p.line_bytes = p.pair_ticks[i].first;
+            break;
         }
-        if ((int)s == 42) printf("turbo\n");
     }
 
-    printf("#N\tforward\treverse\trandom (ticks/access)\n");
+    // префетчер «дотягивается», пока обход по порядку заметно дешевле
+    // случайного обхода тех же строк
+    for (int s = 64; s <= 8192; s *= 2) {
+        auto [seq, rnd] = measure_stride_ticks(a, n, s / (int)sizeof(int), accesses);
+        p.stride_ticks.push_back({s, seq, rnd});
+        if (seq < 0.5 * rnd) p.prefetch_bytes = s;
+    }
+
+    free(a);
+    return p;
+}
 
-    int N = 256;
+static void print_analysis(const vector<SweepPoint> &pts, const vector<SysCache> &sys,
+                           const StrideProfile &sp, FILE *out, const char *prefix) {
+    vector<double> line, page;
+    for (auto &p : pts) {
+        line.push_back(p.line);
+        page.push_back(p.page);
+    }
 
-    // идём до ~256 МБ
+    vector<Level> levels = find_levels(line);
+    fprintf(out, "%scache levels (random chase, one element per line):\n", prefix);
+    for (size_t i = 0; i < levels.size(); ++i) {
+        const Level &l = levels[i];
+        bool last = i + 1 == levels.size();
+        long bytes = (long)pts[l.last].N * (long)sizeof(int);
+        fprintf(out, "%sL%zu\t", prefix, i + 1);
+        if (last) fprintf(out, "memory\t\t");
+        else fprintf(out, "%ld KB\t", bytes / 1024);
+        fprintf(out, "%.2f ns\t%.1f cycles", ticks_to_ns(l.ticks), ticks_to_cycles(l.ticks));
+        if (!last && i < sys.size())
+            fprintf(out, "\t(sysfs L%d %s: %ld KB, %ld-way)", sys[i].level, sys[i].type.c_str(),
+                    sys[i].size_bytes / 1024, sys[i].ways);
+        fprintf(out, "\n");
+    }
+
+    // одна строка на страницу: рабочий набор строк мал, ступени дают в основном TLB
+    vector<Level> tlb = find_levels(page);
+    fprintf(out, "%sTLB levels (random chase, one element per page):\n", prefix);
+    for (size_t i = 0; i + 1 < tlb.size(); ++i) {
+        long bytes = (long)pts[tlb[i].last].N * (long)sizeof(int);
+        fprintf(out, "%sreach %ld KB (~%ld pages)\t%.2f ns\t%.1f cycles\n", prefix,
+                bytes / 1024, bytes / 4096, ticks_to_ns(tlb[i].ticks), ticks_to_cycles(tlb[i].ticks));
+    }
+
+    fprintf(out, "%sline size: %d B", prefix, sp.line_bytes);
+    if (!sys.empty() && sys[0].line_bytes > 0) fprintf(out, " (sysfs %ld B)", sys[0].line_bytes);
+    fprintf(out, "\n");
+    fprintf(out, "%sstride sweep (buffer %zu MB): stride\tin order\tshuffled (ticks/access)\n",
+            prefix, sp.buf_bytes >> 20);
+    for (auto &q : sp.stride_ticks)
+        fprintf(out, "%s%d\t%.3f\t%.3f\n", prefix, q.stride_bytes, q.seq_ticks, q.rnd_ticks);
+    fprintf(out, "%sprefetcher reach: stride up to %d B\n", prefix, sp.prefetch_bytes);
+}
+
+// профиль машины в формате key=value для подбора размеров тайлов
+static bool write_profile(const char *path, const vector<SweepPoint> &pts, const StrideProfile &sp) {
+    FILE *f = fopen(path, "w");
+    if (!f) return false;
+
+    vector<double> line;
+    for (auto &p : pts) line.push_back(p.line);
+    vector<Level> levels = find_levels(line);
+
+    fprintf(f, "tsc_hz=%.0f\n", g_cpu.tsc_hz);
+    fprintf(f, "levels=%zu\n", levels.size());
+    for (size_t i = 0; i < levels.size(); ++i) {
+        bool last = i + 1 == levels.size();
+        long bytes = last ? 0 : (long)pts[levels[i].last].N * (long)sizeof(int);
+        fprintf(f, "L%zu.size_bytes=%ld\n", i + 1, bytes);
+        fprintf(f, "L%zu.latency_ns=%.3f\n", i + 1, ticks_to_ns(levels[i].ticks));
+        fprintf(f, "L%zu.latency_cycles=%.2f\n", i + 1, ticks_to_cycles(levels[i].ticks));
+    }
+    fprintf(f, "line_bytes=%d\n", sp.line_bytes);
+    fprintf(f, "prefetch_stride_bytes=%d\n", sp.prefetch_bytes);
+    fclose(f);
+    return true;
+}
+
+// ---------- записи результатов (CSV / JSON lines) ----------
+
+struct Records {
+    FILE *f = nullptr;
+    bool json = false;
+};
+
+static Records g_records;
+
+static bool records_open(const char *path) {
+    g_records.f = fopen(path, "w");
+    if (!g_records.f) return false;
+    size_t len = strlen(path);
+    g_records.json = len >= 5 && strcmp(path + len - 5, ".json") == 0;
+    if (!g_records.json) {
+        fprintf(g_records.f, "N,bytes,pattern,ticks,ns,ci,repeats,ipc");
+        for (int i = 0; i < PC_COUNT; ++i) fprintf(g_records.f, ",%s", PERF_NAMES[i]);
+        fprintf(g_records.f, "\n");
+    }
+    return true;
+}
+
+// одна точка свипа: паттерн, оценка и счётчики на обращение
+static void records_write(int N, const char *pattern, const Estimate &e, const PerfSample &p) {
+    FILE *f = g_records.f;
+    if (!f) return;
+    bool ipc_ok = p.has[PC_CYCLES] && p.has[PC_INSTRUCTIONS] && p.v[PC_CYCLES] > 0;
+    double ipc = ipc_ok ? p.v[PC_INSTRUCTIONS] / p.v[PC_CYCLES] : 0;
+    size_t bytes = (size_t)N * sizeof(int);
+
+    if (g_records.json) {
+        fprintf(f, "{\"N\":%d,\"bytes\":%zu,\"pattern\":\"%s\",\"ticks\":%.4f,\"ns\":%.4f,\"ci\":%.5f,\"repeats\":%d",
+                N, bytes, pattern, e.median, ticks_to_ns(e.median), e.ci, e.repeats);
+        if (ipc_ok) fprintf(f, ",\"ipc\":%.4f", ipc);
+        for (int i = 0; i < PC_COUNT; ++i)
+            if (p.has[i]) fprintf(f, ",\"%s\":%.6f", PERF_NAMES[i], p.v[i]);
+        fprintf(f, "}\n");
+    } else {
+        fprintf(f, "%d,%zu,%s,%.4f,%.4f,%.5f,%d,", N, bytes, pattern, e.median, ticks_to_ns(e.median), e.ci, e.repeats);
+        if (ipc_ok) fprintf(f, "%.4f", ipc);
+        for (int i = 0; i < PC_COUNT; ++i) {
+            fprintf(f, ",");
+            if (p.has[i]) fprintf(f, "%.6f", p.v[i]);
+        }
+        fprintf(f, "\n");
+    }
+}
+
+// размеры свипа: от 1 КБ до ~256 МБ с шагом 1.2
+static vector<int> sweep_sizes() {
     const int Nmax = 64 * 1024 * 1024;
+    vector<int> sizes;
+    for (int N = 256; N <= Nmax; ) {
+        sizes.push_back(N);
+        N = (int)floor(N * 1.2);
+        if (N <= 0) N = 1;
+    }
+    return sizes;
+}
 
-    // диапазон обращений
-    const long long min_accesses = 20'000'000LL;
+// подбираем K так, чтобы N*K было в [min_accesses, max_accesses].
+// Точность набирается числом повторов (см. sample_until_stable), поэтому
+// один замер может быть коротким.
+static long long pick_K(int N) {
+    const long long min_accesses = 4'000'000LL;
     const long long max_accesses = 500'000'000LL;
 
-    while (N <= Nmax) {
-        int *a = (int*)malloc((size_t)N * sizeof(int));
+    long long K = min_accesses / N;
+    if (K < 1) K = 1;
+    if (N*K > max_accesses) K = max_accesses / N;
+    if (K < 1) K = 1;
+    return K;
+}
+
+static void run_sweep(const Options &opt, PagePolicy policy) {
+    printf("# median of %d..%d repeats, stop when 95%% CI half-width <= %.1f%%\n",
+           g_sampling.min_repeats, g_sampling.max_repeats, g_sampling.tolerance * 100);
+    printf("#N\tforward\treverse\trandom\tline\tpage\tci%%\t(ticks/access; ci%% — widest CI of the row)\n");
+
+    vector<SweepPoint> pts;
+
+    for (int N : sweep_sizes()) {
+        Buffer b = alloc_buffer((size_t)N * sizeof(int), policy);
+        int *a = (int*)b.p;
         if (!a) {
-            printf("malloc failed at N=%d\n", N);
+            printf("allocation failed at N=%d\n", N);
             break;
         }
 
-        // подбираем K так, чтобы N*K было в [min_accesses, max_accesses]
-        long long K = min_accesses / N;
-        if (K < 1) K = 1;
-        if (N*K > max_accesses) K = max_accesses / N;
-        if (K < 1) K = 1;
+        long long K = pick_K(N);
 
         // прямой
         make_forward(a, N);
-        double fwd = measure_ticks_per_access(a, N, K);
+        perf_reset_acc();
+        Estimate fwd = measure_ticks_per_access(a, N, K);
+        records_write(N, "forward", fwd, perf_per_access());
 
         // обратный
         make_backward(a, N);
-        double bwd = measure_ticks_per_access(a, N, K);
+        perf_reset_acc();
+        Estimate bwd = measure_ticks_per_access(a, N, K);
+        records_write(N, "reverse", bwd, perf_per_access());
 
         // случайный
-        double rnd = measure_random_ticks_per_access(a, N, K);
+        perf_reset_acc();
+        Estimate rnd = measure_random_ticks_per_access(a, N, 1, K);
+        records_write(N, "random", rnd, perf_per_access());
 
-        printf("%d\t%.3f\t%.3f\t%.3f\n", N, fwd, bwd, rnd);
+        // случайный по строкам кэша и по страницам
+        perf_reset_acc();
+        Estimate line = measure_random_ticks_per_access(a, N, LINE_INTS, K);
+        records_write(N, "line", line, perf_per_access());
+        perf_reset_acc();
+        Estimate page = measure_random_ticks_per_access(a, N, PAGE_INTS, K);
+        records_write(N, "page", page, perf_per_access());
 
-        free(a);
+        double ci = max({fwd.ci, bwd.ci, rnd.ci, line.ci, page.ci});
+        printf("%d\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.2f\n", N, fwd.median, bwd.median,
+               rnd.median, line.median, page.median, ci * 100);
+        pts.push_back({N, fwd.median, bwd.median, rnd.median, line.median, page.median});
 
-        N = (int)floor(N * 1.2);
-        if (N <= 0) N = 1;
+        free_buffer(b);
+    }
+
+    if (pts.size() < 4) return;
+
+    // шаговый свип на буфере заведомо больше последнего уровня кэша
+    vector<SysCache> sys = read_sys_caches(opt.cpu);
+    size_t stride_buf = 64u << 20;
+    if (!sys.empty())
+        stride_buf = min(max((size_t)sys.back().size_bytes * 4, stride_buf), (size_t)256 << 20);
+    StrideProfile sp = stride_sweep(stride_buf);
+
+    print_analysis(pts, sys, sp, stdout, "# ");
+    if (opt.profile && !write_profile(opt.profile, pts, sp))
+        fprintf(stderr, "warning: could not write profile to %s\n", opt.profile);
+}
+
+// ---------- параллелизм памяти (MLP) ----------
+
+// C независимых цепочек в одном цикле. C — параметр шаблона, чтобы
+// компилятор развернул внутренний цикл и держал k[] в регистрах.
+template <int C>
+static double measure_chains_once(const int *x, const int *starts, long long steps) {
+    int k[C];
+    for (int c = 0; c < C; ++c) k[c] = starts[c];
+
+    uint64_t t1 = rdtsc_precise();
+    for (long long i = 0; i < steps; ++i) {
+#pragma GCC unroll 32
+        for (int c = 0; c < C; ++c)
+            k[c] = x[k[c]];
+    }
+    uint64_t t2 = rdtsc_precise();
+
+    int s = 0;
+    for (int c = 0; c < C; ++c) s += k[c];
+    if (s == -1) printf("use\n");
+
+    return double(t2 - t1) / double(steps);
+}
+
+const int MAX_CHAINS = 32;
+
+using ChainFn = double (*)(const int *, const int *, long long);
+
+template <int... Cs>
+static constexpr array<ChainFn, sizeof...(Cs)> make_chain_table(integer_sequence<int, Cs...>) {
+    return {&measure_chains_once<Cs + 1>...};
+}
+
+// CHAIN_FNS[C - 1] — вариант для C цепочек
+static constexpr auto CHAIN_FNS = make_chain_table(make_integer_sequence<int, MAX_CHAINS>{});
+
+// размеры буферов «внутри» каждого уровня: половина кэша и память.
+// Уровни без размера в sysfs пропускаются.
+static vector<size_t> level_buffer_sizes(const vector<SysCache> &sys) {
+    vector<size_t> sizes;
+    for (auto &c : sys)
+        if (c.size_bytes > 0) sizes.push_back((size_t)c.size_bytes / 2);
+    if (sizes.empty()) sizes = {16u << 10, 512u << 10, 8u << 20};
+    size_t mem = 0;
+    for (auto &c : sys) mem = max(mem, (size_t)max(c.size_bytes, 0L) * 4);
+    sizes.push_back(min(max(mem, (size_t)64 << 20), (size_t)256 << 20));
+    return sizes;
+}
+
+static void run_mlp(const Options &opt, PagePolicy policy) {
+    vector<SysCache> sys = read_sys_caches(opt.cpu);
+    const long long accesses = 10'000'000LL;
+
+    for (size_t bytes : level_buffer_sizes(sys)) {
+        int N = int(bytes / sizeof(int));
+        Buffer b = alloc_buffer(bytes, policy);
+        int *a = (int*)b.p;
+        if (!a) {
+            printf("allocation failed at N=%d\n", N);
+            break;
+        }
+
+        // один цикл по строкам; цепочки стартуют равномерно вдоль него
+        int M = make_random_strided_cycle(a, N, LINE_INTS);
+        vector<int> order(M);
+        for (int i = 0, k = 0; i < M; ++i, k = a[k])
+            order[i] = k;
+
+        printf("# buffer %zu KB, %d lines\n", bytes / 1024, M);
+        printf("#chains\tticks/step\tns/access\tGB/s\n");
+
+        double best_bw = 0;
+        vector<double> bw(MAX_CHAINS + 1);
+        for (int C = 1; C <= MAX_CHAINS; ++C) {
+            vector<int> starts(C);
+            for (int c = 0; c < C; ++c)
+                starts[c] = order[(size_t)M * c / C];
+
+            long long steps = max(accesses / C, 1LL);
+            CHAIN_FNS[C - 1](a, starts.data(), min<long long>(steps, M));  // прогрев
+            vector<double> v;
+            for (int r = 0; r < 3; ++r)
+                v.push_back(CHAIN_FNS[C - 1](a, starts.data(), steps));
+            double t = median_d(v);
+
+            double ns = ticks_to_ns(t / C);
+            bw[C] = 64.0 / ns;  // байт/нс = ГБ/с
+            best_bw = max(best_bw, bw[C]);
+            printf("%d\t%.3f\t%.3f\t%.3f\n", C, t, ns, bw[C]);
+        }
+
+        // число цепочек, после которого полоса почти не растёт —
+        // оценка числа одновременных промахов (LFB/MSHR) на этом уровне
+        int sat = MAX_CHAINS;
+        for (int C = 1; C <= MAX_CHAINS; ++C) {
+            if (bw[C] >= 0.9 * best_bw) {
+                sat = C;
+                break;
+            }
+        }
+        printf("# saturates at ~%d chains (%.3f GB/s, %.1fx single chain)\n\n", sat, best_bw, best_bw / bw[1]);
+
+        free_buffer(b);
+    }
+}
+
+// ---------- задержка под нагрузкой ----------
+
+enum class Traffic { Read, Write, NonTemporal };
+
+struct alignas(64) GenCounter {
+    atomic<uint64_t> bytes{0};
+};
+
+// фоновые потоки, гоняющие трафик по своим буферам блоками по 4 КБ.
+// После каждого блока поток ждёт delay итераций pause; delay < 0 — простой.
+struct LoadGenerators {
+    atomic<int> delay{-1};
+    atomic<bool> stop{false};
+    atomic<int> started{0};         // поток готов: прикреплён, буфер заполнен
+    atomic<int> pin_failed{0};
+    atomic<int> alloc_failed{0};
+    vector<GenCounter> counters;
+    vector<thread> threads;
+
+    uint64_t total_bytes() const {
+        uint64_t s = 0;
+        for (auto &c : counters) s += c.bytes.load(memory_order_relaxed);
+        return s;
+    }
+};
+
+static void load_generator(LoadGenerators &g, int id, int cpu, Traffic traffic, size_t bytes) {
+    // неприкреплённый поток мог бы оказаться на измеряющем ядре
+    if (!pin_thread_to_cpu(cpu)) {
+        fprintf(stderr, "could not pin load thread to cpu %d\n", cpu);
+        g.pin_failed.fetch_add(1);
+        g.started.fetch_add(1);
+        return;
+    }
+
+    const size_t BLOCK = 4096;
+    char *buf = (char*)_mm_malloc(bytes, 64);
+    if (!buf) {
+        fprintf(stderr, "could not allocate %zu MB for load thread on cpu %d\n", bytes >> 20, cpu);
+        g.alloc_failed.fetch_add(1);
+        g.started.fetch_add(1);
+        return;
+    }
+    // страницы набиваем до старта замеров, иначе первые строки (и простой)
+    // идут вместе с page fault'ами генераторов
+    memset(buf, 1, bytes);
+    g.started.fetch_add(1);
+
+    size_t pos = 0;
+    uint64_t sum = 0;
+    while (!g.stop.load(memory_order_relaxed)) {
+        int d = g.delay.load(memory_order_relaxed);
+        if (d < 0) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+            continue;
+        }
+
+        char *p = buf + pos;
+        switch (traffic) {
+            case Traffic::Read:
+                for (size_t i = 0; i < BLOCK; i += sizeof(uint64_t))
+                    sum += *(const uint64_t*)(p + i);
+                break;
+            case Traffic::Write:
+                memset(p, (int)pos, BLOCK);
+                break;
+            case Traffic::NonTemporal: {
+                __m128i v = _mm_set1_epi32((int)pos);
+                for (size_t i = 0; i < BLOCK; i += 16)
+                    _mm_stream_si128((__m128i*)(p + i), v);
+                _mm_sfence();
+                break;
+            }
+        }
+        g.counters[id].bytes.fetch_add(BLOCK, memory_order_relaxed);
+
+        pos += BLOCK;
+        if (pos + BLOCK > bytes) pos = 0;
+        for (int i = 0; i < d; ++i) _mm_pause();
+    }
+
+    if (sum == 1) printf("use\n");
+    _mm_free(buf);
+}
+
+static bool parse_traffic(const string &s, Traffic &t) {
+    if (s == "read") t = Traffic::Read;
+    else if (s == "write") t = Traffic::Write;
+    else if (s == "nt") t = Traffic::NonTemporal;
+    else return false;
+    return true;
+}
+
+static void run_loaded(const Options &opt, PagePolicy policy) {
+    // фоновые потоки — только на разрешённых ядрах, кроме измеряющего
+    vector<int> cpus;
+    for (int c : g_allowed_cpus)
+        if (c != opt.cpu) cpus.push_back(c);
+    if (cpus.empty()) {
+        fprintf(stderr, "loaded mode needs an allowed cpu besides cpu %d\n", opt.cpu);
+        return;
+    }
+
+    int nthreads = opt.threads >= 0 ? opt.threads : (int)cpus.size();
+    if (nthreads <= 0) {
+        fprintf(stderr, "loaded mode needs at least one background thread (--threads N)\n");
+        return;
+    }
+    if (nthreads > (int)cpus.size())
+        fprintf(stderr, "warning: %d load threads on %zu cpus, they will share cores\n", nthreads, cpus.size());
+
+    Traffic traffic = Traffic::Read;
+    parse_traffic(opt.traffic, traffic);
+
+    vector<SysCache> sys = read_sys_caches(opt.cpu);
+    vector<size_t> sizes = level_buffer_sizes(sys);
+    // вместе буферы фоновых потоков заведомо больше LLC (sizes.back()),
+    // но не больше GEN_TOTAL на всех — на больших машинах потоков десятки
+    const size_t GEN_TOTAL = (size_t)1 << 30;
+    size_t gen_bytes = min(sizes.back(), GEN_TOTAL / nthreads);
+    gen_bytes = max(gen_bytes & ~(size_t)4095, (size_t)64 << 10);
+
+    LoadGenerators g;
+    g.counters = vector<GenCounter>(nthreads);
+    for (int i = 0; i < nthreads; ++i)
+        g.threads.emplace_back(load_generator, ref(g), i, cpus[i % cpus.size()], traffic, gen_bytes);
+
+    while (g.started.load() < nthreads)
+        this_thread::sleep_for(chrono::milliseconds(1));
+    if (g.pin_failed.load() || g.alloc_failed.load()) {
+        g.stop.store(true);
+        for (auto &t : g.threads) t.join();
+        return;
+    }
+
+    printf("# %d load thread(s), %s traffic, %zu KB each\n", nthreads, opt.traffic.c_str(), gen_bytes >> 10);
+
+    // от простоя до максимальной нагрузки
+    const int delays[] = {-1, 4096, 1024, 256, 64, 16, 4, 0};
+    const long long accesses = 5'000'000LL;
+
+    for (size_t bytes : sizes) {
+        int N = int(bytes / sizeof(int));
+        Buffer b = alloc_buffer(bytes, policy);
+        int *a = (int*)b.p;
+        if (!a) {
+            printf("allocation failed at N=%d\n", N);
+            break;
+        }
+        int M = make_random_strided_cycle(a, N, LINE_INTS);
+
+        printf("# buffer %zu KB\n", bytes / 1024);
+        printf("#delay\tGB/s\tns/access\tticks/access\n");
+
+        for (int d : delays) {
+            g.delay.store(d);
+            this_thread::sleep_for(chrono::milliseconds(20));
+
+            uint64_t b0 = g.total_bytes();
+            auto c0 = chrono::steady_clock::now();
+            vector<double> v;
+            for (int r = 0; r < 3; ++r)
+                v.push_back(measure_ticks_per_access_once(a, accesses, warmup_for(M, 64)));
+            auto c1 = chrono::steady_clock::now();
+            uint64_t b1 = g.total_bytes();
+
+            double t = median_d(v);
+            double gbps = double(b1 - b0) / chrono::duration<double>(c1 - c0).count() / 1e9;
+            printf("%d\t%.3f\t%.3f\t%.3f\n", d, gbps, ticks_to_ns(t), t);
+        }
+        printf("\n");
+
+        g.delay.store(-1);
+        free_buffer(b);
+    }
+
+    g.stop.store(true);
+    for (auto &t : g.threads) t.join();
+}
+
+// ---------- сравнение политик страниц ----------
+
+struct PagePoint {
+    double rnd, page;
+};
+
+// тот же свип для каждой политики: полный случайный цикл и обход
+// по странице; разница между политиками — цена промахов TLB
+static void run_pages() {
+    vector<int> sizes = sweep_sizes();
+    size_t max_bytes = (size_t)sizes.back() * sizeof(int);
+
+    vector<PagePolicy> policies;
+    vector<vector<PagePoint>> results;
+
+    for (PagePolicy p : {PagePolicy::Small, PagePolicy::THP, PagePolicy::Huge2M, PagePolicy::Huge1G}) {
+        long huge0 = anon_huge_kb();
+        Buffer b = alloc_buffer(max_bytes, p);
+        if (!b.p) {
+            printf("# %s: unavailable (no hugetlbfs pages reserved?)\n", page_policy_name(p));
+            continue;
+        }
+        if (p == PagePolicy::THP) {
+            long huge1 = anon_huge_kb();
+            if (huge0 >= 0 && huge1 >= 0)
+                printf("# thp: %ld MB backed by huge pages (buffer %zu MB)\n", (huge1 - huge0) >> 10, max_bytes >> 20);
+        }
+
+        // один буфер на всю политику: N растёт внутри него
+        fprintf(stderr, "measuring %s pages...\n", page_policy_name(p));
+        int *a = (int*)b.p;
+        vector<PagePoint> pts;
+        for (int N : sizes) {
+            long long K = pick_K(N);
+            double rnd = measure_random_ticks_per_access(a, N, 1, K).median;
+            double page = measure_random_ticks_per_access(a, N, PAGE_INTS, K).median;
+            pts.push_back({rnd, page});
+        }
+        free_buffer(b);
+
+        policies.push_back(p);
+        results.push_back(pts);
+    }
+
+    printf("#N");
+    for (PagePolicy p : policies)
+        printf("\t%s:random\t%s:page", page_policy_name(p), page_policy_name(p));
+    printf(" (ticks/access)\n");
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        printf("%d", sizes[i]);
+        for (auto &r : results)
+            printf("\t%.3f\t%.3f", r[i].rnd, r[i].page);
+        printf("\n");
+    }
+}
+
+// ---------- передача строки кэша между ядрами ----------
+
+struct alignas(64) PingPongLine {
+    atomic<uint64_t> v{0};
+};
+
+// строка кэша гоняется между cpu_a и cpu_b: ping переводит 2n -> 2n+1,
+// pong — 2n+1 -> 2n+2. Каждый отсчёт — блок из rounds обменов, в тиках
+// на одну передачу строки (полный обмен — две передачи).
+// Пустой результат — хотя бы один поток не удалось прикрепить к своему ядру.
+static vector<double> ping_pong(int cpu_a, int cpu_b, bool use_cas, int samples, int rounds) {
+    PingPongLine line;
+    atomic<int> ready{0};
+    atomic<bool> pinned{true};
+    vector<double> out(samples);
+    const uint64_t total = (uint64_t)samples * rounds;
+
+    auto step = [&](uint64_t want) {
+        if (use_cas) {
+            uint64_t e = want;
+            while (!line.v.compare_exchange_weak(e, want + 1, memory_order_acq_rel))
+                e = want;
+        } else {
+            while (line.v.load(memory_order_acquire) != want) {}
+            line.v.store(want + 1, memory_order_release);
+        }
+    };
+
+    // пока оба потока не прикреплены, они могут делить одно ядро: ждём
+    // с yield, иначе под SCHED_FIFO крутящийся поток не пустит второй
+    auto meet = [&](int cpu) {
+        if (!pin_thread_to_cpu(cpu)) pinned.store(false);
+        ready.fetch_add(1);
+        while (ready.load() < 2) this_thread::yield();
+        return pinned.load();
+    };
+
+    auto pong = [&] {
+        if (!meet(cpu_b)) return;
+        for (uint64_t n = 0; n < total; ++n)
+            step(2 * n + 1);
+    };
+    auto ping = [&] {
+        if (!meet(cpu_a)) return;
+        uint64_t n = 0;
+        for (int s = 0; s < samples; ++s) {
+            uint64_t t1 = rdtsc_precise();
+            for (int r = 0; r < rounds; ++r, ++n)
+                step(2 * n);
+            uint64_t t2 = rdtsc_precise();
+            out[s] = double(t2 - t1) / (2.0 * rounds);
+        }
+    };
+
+    thread b(pong), a(ping);
+    a.join();
+    b.join();
+    if (!pinned.load()) out.clear();
+    return out;
+}
+
+static void print_topology(const vector<int> &cpus) {
+    printf("#cpu\tcore\tpackage\tSMT siblings\tL3 shared with\n");
+    for (int c : cpus) {
+        string dir = "/sys/devices/system/cpu/cpu" + to_string(c) + "/";
+        string sib = read_sysfs_string(dir + "topology/thread_siblings_list");
+        string l3 = read_sysfs_string(dir + "cache/index3/shared_cpu_list");
+        printf("# %d\t%ld\t%ld\t%s\t%s\n", c, read_sysfs_long(dir + "topology/core_id"),
+               read_sysfs_long(dir + "topology/physical_package_id"),
+               sib.empty() ? "-" : sib.c_str(), l3.empty() ? "-" : l3.c_str());
+    }
+}
+
+// NAN — пару не удалось прикрепить
+static void print_matrix(const char *title, const vector<int> &cpus, const vector<vector<double>> &m) {
+    int n = (int)m.size();
+    printf("# %s\n", title);
+    printf("#cpu");
+    for (int j = 0; j < n; ++j) printf("\t%d", cpus[j]);
+    printf("\n");
+    for (int i = 0; i < n; ++i) {
+        printf("%d", cpus[i]);
+        for (int j = 0; j < n; ++j) {
+            if (i == j) printf("\t-");
+            else if (std::isnan(m[i][j])) printf("\tn/a");
+            else printf("\t%.1f", m[i][j]);
+        }
+        printf("\n");
+    }
+}
+
+static void run_c2c(const Options &opt) {
+    const vector<int> &cpus = g_allowed_cpus;
+    int ncpu = (int)cpus.size();
+    if (ncpu < 2) {
+        fprintf(stderr, "c2c mode needs at least two allowed cpus\n");
+        return;
+    }
+    bool use_cas = opt.sync != "store";
+
+    print_topology(cpus);
+
+    const int samples = 1000, rounds = 64;
+    vector<vector<double>> med(ncpu, vector<double>(ncpu)), p99 = med;
+
+    for (int i = 0; i < ncpu; ++i) {
+        for (int j = 0; j < ncpu; ++j) {
+            if (i == j) continue;
+            vector<double> v = ping_pong(cpus[i], cpus[j], use_cas, samples, rounds);
+            if (v.empty()) {
+                fprintf(stderr, "warning: could not pin to cpus %d and %d\n", cpus[i], cpus[j]);
+                med[i][j] = p99[i][j] = NAN;
+                continue;
+            }
+            sort(v.begin(), v.end());
+            med[i][j] = ticks_to_ns(v[v.size() / 2]);
+            p99[i][j] = ticks_to_ns(v[v.size() * 99 / 100]);
+        }
     }
 
+    printf("# one-way cache line transfer, %s, ns\n", use_cas ? "compare-and-swap" : "store and wait");
+    print_matrix("median", cpus, med);
+    print_matrix("p99", cpus, p99);
+}
+
+// ---------- запись: последовательная, случайная, RMW, non-temporal ----------
+
+enum class WriteKernel { Seq, Random, RMW, NT };
+
+// ticks на строку кэша за passes проходов по буферу. Все ядра пишут
+// буфер целиком, по 64 байта на строку; случайная запись — те же строки
+// в порядке order (цена RFO без помощи префетчера).
+static double measure_write_once(WriteKernel kind, char *buf, size_t bytes,
+                                 const vector<uint32_t> &order, int passes) {
+    uint64_t *q = (uint64_t*)buf;
+    size_t words = bytes / sizeof(uint64_t);
+    size_t lines = bytes / 64;
+
+    uint64_t t1 = rdtsc_precise();
+    for (int p = 0; p < passes; ++p) {
+        switch (kind) {
+            case WriteKernel::Seq:
+                for (size_t i = 0; i < words; ++i)
+                    q[i] = i + p;
+                break;
+            case WriteKernel::Random:
+                for (size_t i = 0; i < lines; ++i) {
+                    uint64_t *l = q + (size_t)order[i] * 8;
+                    for (int j = 0; j < 8; ++j)
+                        l[j] = i + p;
+                }
+                break;
+            case WriteKernel::RMW:
+                for (size_t i = 0; i < words; ++i)
+                    q[i] += 1;
+                break;
+            case WriteKernel::NT: {
+                __m128i v = _mm_set1_epi32(p);
+                for (size_t i = 0; i < bytes; i += 16)
+                    _mm_stream_si128((__m128i*)(buf + i), v);
+                _mm_sfence();
+                break;
+            }
+        }
+        // не даём выкинуть запись в буфер, который потом только освобождается
+        __asm__ __volatile__("" : : "r"(buf) : "memory");
+    }
+    uint64_t t2 = rdtsc_precise();
+
+    return double(t2 - t1) / (double(lines) * passes);
+}
+
+static void run_write(PagePolicy policy) {
+    const WriteKernel kinds[] = {WriteKernel::Seq, WriteKernel::Random, WriteKernel::RMW, WriteKernel::NT};
+    // на один замер — не меньше 16 МБ записи
+    const size_t bytes_per_sample = 16u << 20;
+
+    printf("#N\tseq\trandom\trmw\tnt (GB/s)\tseq\trandom\trmw\tnt (cycles/line)\n");
+
+    for (int N : sweep_sizes()) {
+        size_t bytes = (size_t)N * sizeof(int) / 64 * 64;
+        if (bytes < 64) continue;
+        Buffer b = alloc_buffer(bytes, policy);
+        char *buf = (char*)b.p;
+        if (!buf) {
+            printf("allocation failed at N=%d\n", N);
+            break;
+        }
+
+        size_t lines = bytes / 64;
+        vector<uint32_t> order(lines);
+        for (size_t i = 0; i < lines; ++i) order[i] = (uint32_t)i;
+        shuffle(order.begin(), order.end(), g_rng);
+
+        int passes = (int)max<size_t>(1, bytes_per_sample / bytes);
+
+        double gbps[4], cyc[4];
+        for (int k = 0; k < 4; ++k) {
+            measure_write_once(kinds[k], buf, bytes, order, 1);  // прогрев и page fault'ы
+            Estimate e = sample_until_stable([&] {
+                return measure_write_once(kinds[k], buf, bytes, order, passes);
+            });
+            gbps[k] = 64.0 / ticks_to_ns(e.median);
+            cyc[k] = ticks_to_cycles(e.median);
+        }
+
+        printf("%d\t%.3f\t%.3f\t%.3f\t%.3f\t%.2f\t%.2f\t%.2f\t%.2f\n", N,
+               gbps[0], gbps[1], gbps[2], gbps[3], cyc[0], cyc[1], cyc[2], cyc[3]);
+
+        free_buffer(b);
+    }
+}
+
+int main(int argc, char **argv) {
+    Options opt = parse_args(argc, argv);
+    PagePolicy policy;
+    if (!parse_page_policy(opt.pages, policy)) {
+        fprintf(stderr, "unknown page policy: %s\n", opt.pages.c_str());
+        return 1;
+    }
+    Traffic traffic;
+    if (!parse_traffic(opt.traffic, traffic)) {
+        fprintf(stderr, "unknown traffic kind: %s\n", opt.traffic.c_str());
+        return 1;
+    }
+    g_rng.seed((uint64_t)time(nullptr));
+
+    // фиксируем процесс на одном ядре и поднимаем приоритет
+    g_allowed_cpus = allowed_cpus();
+    if (opt.cpu < 0) {
+        const vector<int> &c = g_allowed_cpus;
+        opt.cpu = find(c.begin(), c.end(), 2) != c.end() ? 2 : c.back();
+    }
+    if (!pin_to_cpu(opt.cpu))
+        fprintf(stderr, "warning: could not pin to cpu %d\n", opt.cpu);
+    if (!raise_priority(opt.fifo))
+        fprintf(stderr, "warning: could not raise priority (SCHED_FIFO needs root)\n");
+
+    warmup_until_stable();
+    read_cpu_info(opt.cpu);
+    print_cpu_info(opt.cpu);
+
+    g_sampling.tolerance = opt.tol / 100;
+    g_sampling.max_repeats = max(opt.max_repeats, g_sampling.min_repeats);
+    vector<SysCache> sys = read_sys_caches(opt.cpu);
+    // без размера LLC в sysfs остаётся значение по умолчанию, а не ноль
+    if (!sys.empty() && sys.back().size_bytes > 0)
+        g_sampling.warmup_bytes = 2LL * sys.back().size_bytes;
+
+    perf_init(opt.l2_raw);
+    perf_print_status();
+    if (opt.records && !records_open(opt.records))
+        fprintf(stderr, "warning: could not open %s\n", opt.records);
+
+    if (opt.mode == "mlp")
+        run_mlp(opt, policy);
+    else if (opt.mode == "loaded")
+        run_loaded(opt, policy);
+    else if (opt.mode == "pages")
+        run_pages();
+    else if (opt.mode == "c2c")
+        run_c2c(opt);
+    else if (opt.mode == "write")
+        run_write(policy);
+    else
+        run_sweep(opt, policy);
+
+    if (g_records.f) fclose(g_records.f);
     return 0;
 }